@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string.h>
+
+// all files of res/ in a single file, written by the packer tool (packer.cpp)
+// tetris maps the pack once at startup (next to the executable) and mapFile() returns views
+// into it, loose files are used if there is no pack
+//
+// layout: AssetPackHeader, AssetPackEntry[tableSize], payloads (assetPackAlignment aligned)
+
+struct AssetPackHeader
+{
+    char magic[4]; // APAK
+    int version;
+    int numEntries;
+    int tableSize; // power of 2, open addressing with linear probing
+};
+
+struct AssetPackEntry
+{
+    unsigned long long hash; // 0 - empty slot
+    long long offset; // from the beginning of the pack
+    long long size;
+    char name[104]; // "res/github.png"
+};
+
+const int assetPackVersion = 1;
+const int assetPackAlignment = 64;
+
+// FNV-1a of the name, never 0
+inline unsigned long long hashAssetName(const char* name)
+{
+    unsigned long long hash = 14695981039346656037ull;
+
+    for(; *name; ++name)
+    {
+        hash ^= (unsigned char)*name;
+        hash *= 1099511628211ull;
+    }
+
+    return hash + (hash == 0);
+}
+
+// returns nullptr if there is no such asset
+inline const AssetPackEntry* findAssetPackEntry(const AssetPackHeader& header, const char* name)
+{
+    const AssetPackEntry* const table = (const AssetPackEntry*)(&header + 1);
+    const unsigned long long hash = hashAssetName(name);
+    const int mask = header.tableSize - 1;
+
+    for(int i = hash & mask; table[i].hash; i = (i + 1) & mask)
+    {
+        if(table[i].hash == hash && strcmp(table[i].name, name) == 0)
+            return &table[i];
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,295 @@
+// offscreen capture to a Y4M video, see Scene.hpp
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct CaptureFrame
+{
+    unsigned char* rgba; // glReadPixels() rows, bottom up
+    int numCopies;
+};
+
+static const int captureRingSize = 3;
+static const int captureMaxQueued = 8;
+
+static struct
+{
+    bool active = false;
+    ivec2 size;
+    int fps;
+    FILE* file;
+
+    GLuint fbo;
+    GLuint colorRbo;
+
+    // frames are read back into the ring and mapped captureRingSize - 1 frames later,
+    // the transfer is done by then and glMapBuffer() does not stall
+    GLuint pbos[captureRingSize];
+    GLsync fences[captureRingSize];
+    int numCopies[captureRingSize];
+    int ringHead; // next pbo to read into
+    int ringCount;
+
+    std::thread encoder;
+    std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameEncoded;
+    Array<CaptureFrame> queue; // FIFO
+    Array<unsigned char*> freeBuffers;
+    bool quit;
+
+    int numFramesWritten;
+    Array<unsigned char> yuv; // encoder thread only
+} capture;
+
+// full range BT.601 (C420jpeg), 4:2:0 subsampling
+static void encodeY4mFrame(const unsigned char* const rgba)
+{
+    const ivec2 size = capture.size;
+    Array<unsigned char>& yuv = capture.yuv;
+    yuv.resize(size.x * size.y * 3 / 2);
+    unsigned char* const yPlane = yuv.data();
+    unsigned char* const uPlane = yPlane + size.x * size.y;
+    unsigned char* const vPlane = uPlane + size.x * size.y / 4;
+
+    for(int y = 0; y < size.y; y += 2)
+    {
+        for(int x = 0; x < size.x; x += 2)
+        {
+            float uSum = 0.f;
+            float vSum = 0.f;
+
+            for(int j = 0; j < 2; ++j)
+            {
+                for(int i = 0; i < 2; ++i)
+                {
+                    // flip, y4m rows are top down
+                    const unsigned char* const p = rgba + ((size.y - 1 - (y + j)) * size.x +
+                                                           x + i) * 4;
+                    const float r = p[0];
+                    const float g = p[1];
+                    const float b = p[2];
+
+                    yPlane[(y + j) * size.x + x + i] = 0.299f * r + 0.587f * g + 0.114f * b +
+                                                       0.5f;
+
+                    uSum += -0.168736f * r - 0.331264f * g + 0.5f * b;
+                    vSum += 0.5f * r - 0.418688f * g - 0.081312f * b;
+                }
+            }
+
+            const int idx = (y / 2) * (size.x / 2) + x / 2;
+            uPlane[idx] = max(0.f, min(255.f, uSum / 4.f + 128.5f));
+            vPlane[idx] = max(0.f, min(255.f, vSum / 4.f + 128.5f));
+        }
+    }
+}
+
+static void encoderThreadFunc()
+{
+    setThreadName("capture encoder");
+
+    std::unique_lock<std::mutex> lock(capture.mutex);
+
+    while(true)
+    {
+        capture.frameQueued.wait(lock, []{return capture.quit || capture.queue.size();});
+
+        if(capture.queue.empty())
+            return; // quit and drained
+
+        const CaptureFrame frame = capture.queue.front();
+
+        for(int i = 1; i < capture.queue.size(); ++i)
+            capture.queue[i - 1] = capture.queue[i];
+
+        capture.queue.popBack();
+
+        lock.unlock();
+        PROFILE_SCOPE("encodeY4mFrame");
+        encodeY4mFrame(frame.rgba);
+
+        for(int i = 0; i < frame.numCopies; ++i)
+        {
+            fputs("FRAME\n", capture.file);
+            fwrite(capture.yuv.data(), 1, capture.yuv.size(), capture.file);
+        }
+
+        lock.lock();
+
+        capture.numFramesWritten += frame.numCopies;
+        capture.freeBuffers.pushBack(frame.rgba);
+        capture.frameEncoded.notify_all();
+    }
+}
+
+bool startCapture(const char* const filename, const ivec2 size, const int fps)
+{
+    assert(!capture.active);
+
+    if(size.x % 2 || size.y % 2)
+    {
+        printf("startCapture(): the size has to be even (4:2:0 chroma)\n");
+        return false;
+    }
+
+    capture.file = fopen(filename, "wb");
+
+    if(!capture.file)
+    {
+        printf("startCapture() could not open file: %s\n", filename);
+        return false;
+    }
+
+    fprintf(capture.file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", size.x, size.y, fps);
+
+    capture.active = true;
+    capture.size = size;
+    capture.fps = fps;
+    capture.ringHead = 0;
+    capture.ringCount = 0;
+    capture.quit = false;
+    capture.numFramesWritten = 0;
+
+    glGenRenderbuffers(1, &capture.colorRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, capture.colorRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size.x, size.y);
+
+    glGenFramebuffers(1, &capture.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, capture.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+                              capture.colorRbo);
+
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(captureRingSize, capture.pbos);
+
+    for(const GLuint pbo: capture.pbos)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size.x * size.y * 4, nullptr, GL_STREAM_READ);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    capture.encoder = std::thread(encoderThreadFunc);
+    printf("capture: %s %d x %d %d fps\n", filename, size.x, size.y, fps);
+    return true;
+}
+
+bool isCapturing()
+{
+    return capture.active;
+}
+
+ivec2 getCaptureSize()
+{
+    return capture.size;
+}
+
+void beginCaptureFrame()
+{
+    assert(capture.active);
+    glBindFramebuffer(GL_FRAMEBUFFER, capture.fbo);
+    glViewport(0, 0, capture.size.x, capture.size.y);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+// maps the oldest pbo of the ring and queues its copy for the encoder
+static void retireOldestCaptureFrame()
+{
+    const int idx = (capture.ringHead - capture.ringCount + captureRingSize) % captureRingSize;
+    --capture.ringCount;
+
+    glClientWaitSync(capture.fences[idx], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(-1));
+    glDeleteSync(capture.fences[idx]);
+
+    if(!capture.numCopies[idx])
+        return;
+
+    unsigned char* buffer;
+    {
+        std::unique_lock<std::mutex> lock(capture.mutex);
+
+        // the encoder is behind, wait instead of queueing without bound
+        capture.frameEncoded.wait(lock, []{return capture.queue.size() < captureMaxQueued;});
+
+        if(capture.freeBuffers.size())
+        {
+            buffer = capture.freeBuffers.back();
+            capture.freeBuffers.popBack();
+        }
+        else
+            buffer = (unsigned char*)malloc(capture.size.x * capture.size.y * 4);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbos[idx]);
+    const void* const data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    memcpy(buffer, data, capture.size.x * capture.size.y * 4);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    std::lock_guard<std::mutex> lock(capture.mutex);
+    capture.queue.pushBack({buffer, capture.numCopies[idx]});
+    capture.frameQueued.notify_one();
+}
+
+void endCaptureFrame(const int numCopies, const ivec2 windowSize)
+{
+    assert(capture.active);
+
+    if(capture.ringCount == captureRingSize)
+        retireOldestCaptureFrame();
+
+    const int idx = capture.ringHead;
+    capture.ringHead = (capture.ringHead + 1) % captureRingSize;
+    ++capture.ringCount;
+    capture.numCopies[idx] = numCopies;
+
+    // asynchronous, returns as soon as the copy is queued
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbos[idx]);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, capture.size.x, capture.size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    capture.fences[idx] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // show it in the window
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, capture.fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glViewport(0, 0, windowSize.x, windowSize.y);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBlitFramebuffer(0, 0, capture.size.x, capture.size.y, 0, 0, windowSize.x, windowSize.y,
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void stopCapture()
+{
+    if(!capture.active)
+        return;
+
+    while(capture.ringCount)
+        retireOldestCaptureFrame();
+
+    {
+        std::lock_guard<std::mutex> lock(capture.mutex);
+        capture.quit = true;
+        capture.frameQueued.notify_one();
+    }
+
+    capture.encoder.join();
+    fclose(capture.file);
+
+    for(unsigned char* buffer: capture.freeBuffers)
+        free(buffer);
+
+    capture.freeBuffers.clear();
+
+    glDeleteBuffers(captureRingSize, capture.pbos);
+    glDeleteFramebuffers(1, &capture.fbo);
+    glDeleteRenderbuffers(1, &capture.colorRbo);
+    capture.active = false;
+    printf("capture: %d frames written\n", capture.numFramesWritten);
+}
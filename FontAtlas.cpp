@@ -0,0 +1,213 @@
+// include stb_truetype.h first (unity build)
+#include "FontAtlas.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const int fontAtlasVersion = 2;
+
+// returns false if the file does not exist
+static bool getFileStamp(const char* const filename, long long& size, long long& mtime)
+{
+    struct stat s;
+
+    if(stat(filename, &s) != 0)
+        return false;
+
+    size = s.st_size;
+    mtime = s.st_mtime;
+    return true;
+}
+
+bool bakeFontAtlas(const unsigned char* const fontData, const int fontSize,
+                   const int textureWidth, const bool sdf, FontAtlas& atlas)
+{
+    stbtt_fontinfo fontInfo;
+
+    if(stbtt_InitFont(&fontInfo, fontData, 0) == 0)
+    {
+        printf("stbtt_InitFont() failed\n");
+        return false;
+    }
+
+    const float scale = stbtt_ScaleForPixelHeight(&fontInfo, fontSize);
+    float ascent;
+
+    {
+        int descent, lineSpace, ascent_;
+        stbtt_GetFontVMetrics(&fontInfo, &ascent_, &descent, &lineSpace);
+        atlas.lineSpace = (ascent_ - descent + lineSpace) * scale;
+        ascent = ascent_ * scale;
+    }
+
+    int glyphIndices[127] = {};
+    // stbtt_GetGlyphSDF() has no variant that writes into our buffer
+    unsigned char* sdfBitmaps[127] = {};
+    int maxBitmapSizeY = 0;
+    ivec2 pos = {0, 0};
+
+    // layout first, then the glyphs are rendered directly into the atlas
+    for(int i = 32; i < 127; ++i)
+    {
+        Glyph& glyph = atlas.glyphs[i];
+        glyph = {};
+        const int idx = stbtt_FindGlyphIndex(&fontInfo, i);
+
+        if(idx == 0)
+        {
+            printf("stbtt_FindGlyphIndex(%d) failed\n", i);
+            continue;
+        }
+
+        glyphIndices[i] = idx;
+        int advance;
+        int dummy;
+        stbtt_GetGlyphHMetrics(&fontInfo, idx, &advance, &dummy);
+        glyph.advance = advance * scale;
+
+        ivec2 topLeft, bottomRight;
+
+        if(sdf)
+        {
+            // stb returns before writing the offsets for empty glyphs (space)
+            ivec2 sdfSize = {0, 0};
+            topLeft = {0, 0};
+            sdfBitmaps[i] = stbtt_GetGlyphSDF(&fontInfo, scale, idx, sdfPadding, sdfOnEdgeValue,
+                                              sdfPixelDistScale, &sdfSize.x, &sdfSize.y,
+                                              &topLeft.x, &topLeft.y);
+            bottomRight = topLeft + sdfSize;
+        }
+        else
+        {
+            stbtt_GetGlyphBitmapBox(&fontInfo, idx, scale, scale, &topLeft.x, &topLeft.y,
+                                    &bottomRight.x, &bottomRight.y);
+        }
+
+        const ivec2 size = bottomRight - topLeft;
+
+        assert(size.x <= textureWidth);
+        glyph.offset.x = topLeft.x;
+        glyph.offset.y = ascent + topLeft.y;
+        glyph.texRect.z = size.x;
+        glyph.texRect.w = size.y;
+
+        if(pos.x + glyph.texRect.z > textureWidth)
+        {
+            pos.x = 0;
+            pos.y += maxBitmapSizeY + 1;
+            maxBitmapSizeY = 0;
+        }
+
+        glyph.texRect.x = pos.x;
+        glyph.texRect.y = pos.y;
+
+        pos.x += glyph.texRect.z + 1;
+        maxBitmapSizeY = max(maxBitmapSizeY, int(glyph.texRect.w));
+    }
+
+    atlas.size = {textureWidth, pos.y + maxBitmapSizeY};
+    atlas.bitmap.resize(atlas.size.x * atlas.size.y);
+    memset(atlas.bitmap.data(), 0, atlas.bitmap.size());
+
+    for(int i = 32; i < 127; ++i)
+    {
+        if(!glyphIndices[i])
+            continue;
+
+        const vec4& texRect = atlas.glyphs[i].texRect;
+        unsigned char* const dst = atlas.bitmap.data() + int(texRect.y) * atlas.size.x +
+                                   int(texRect.x);
+
+        if(!sdf)
+        {
+            stbtt_MakeGlyphBitmap(&fontInfo, dst, texRect.z, texRect.w, atlas.size.x, scale,
+                                  scale, glyphIndices[i]);
+            continue;
+        }
+
+        // glyphs with no shape (space) have no bitmap
+        if(!sdfBitmaps[i])
+            continue;
+
+        for(int y = 0; y < int(texRect.w); ++y)
+            memcpy(dst + y * atlas.size.x, sdfBitmaps[i] + y * int(texRect.z), texRect.z);
+
+        stbtt_FreeSDF(sdfBitmaps[i], nullptr);
+    }
+
+    return true;
+}
+
+void getFontAtlasFilename(char* const buffer, const int bufferSize,
+                          const char* const fontFilename, const int fontSize,
+                          const int textureWidth, const bool sdf)
+{
+    snprintf(buffer, bufferSize, "%s.%d_%d%s.atlas", fontFilename, fontSize, textureWidth,
+             sdf ? "_sdf" : "");
+}
+
+bool writeFontAtlas(const char* const filename, const char* const fontFilename,
+                    const int fontSize, const int textureWidth, const bool sdf,
+                    const FontAtlas& atlas)
+{
+    FontAtlasHeader header;
+    memcpy(header.magic, "FATL", 4);
+    header.version = fontAtlasVersion;
+    header.glyphSize = sizeof(Glyph);
+    header.fontSize = fontSize;
+    header.textureWidth = textureWidth;
+    header.sdf = sdf;
+
+    if(!getFileStamp(fontFilename, header.sourceSize, header.sourceMtime))
+    {
+        printf("writeFontAtlas() could not stat file: %s\n", fontFilename);
+        return false;
+    }
+
+    header.size = atlas.size;
+    header.lineSpace = atlas.lineSpace;
+    memcpy(header.glyphs, atlas.glyphs, sizeof(header.glyphs));
+
+    FILE* const fp = fopen(filename, "wb");
+
+    if(!fp)
+    {
+        printf("writeFontAtlas() could not open file: %s\n", filename);
+        return false;
+    }
+
+    const bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                    fwrite(atlas.bitmap.data(), 1, atlas.bitmap.size(), fp) ==
+                    size_t(atlas.bitmap.size());
+
+    fclose(fp);
+    return ok;
+}
+
+const FontAtlasHeader* validateFontAtlas(const unsigned char* const data, const int size,
+                                         const char* const fontFilename, const int fontSize,
+                                         const int textureWidth, const bool sdf)
+{
+    if(size < int(sizeof(FontAtlasHeader)))
+        return nullptr;
+
+    const FontAtlasHeader* const header = (const FontAtlasHeader*)data;
+
+    if(memcmp(header->magic, "FATL", 4) != 0 || header->version != fontAtlasVersion ||
+       header->glyphSize != int(sizeof(Glyph)) || header->fontSize != fontSize ||
+       header->textureWidth != textureWidth || header->sdf != int(sdf) ||
+       size != int(sizeof(FontAtlasHeader)) + header->size.x * header->size.y)
+        return nullptr;
+
+    long long sourceSize, sourceMtime;
+
+    // no font file is fine, the atlas is all we need
+    if(getFileStamp(fontFilename, sourceSize, sourceMtime) &&
+       (sourceSize != header->sourceSize || sourceMtime != header->sourceMtime))
+    {
+        printf("font atlas is stale: %s\n", fontFilename);
+        return nullptr;
+    }
+
+    return header;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Array.hpp"
+#include "math.hpp"
+
+struct Glyph
+{
+    vec4 texRect;
+    float advance;
+    vec2 offset;
+};
+
+// CPU side of a Font, no OpenGL here
+// the offline baker (fontBaker.cpp) writes it to a file that createFontFromFile() maps and
+// uploads, the glyph cache pages (GlyphCache.cpp) are placed below it in the font texture
+struct FontAtlas
+{
+    Glyph glyphs[127];
+    float lineSpace;
+    ivec2 size;
+    Array<unsigned char> bitmap; // GL_R8, size.x * size.y
+};
+
+// signed distance field parameters, the glyph edge is at 0.5 (128) in the texture
+const int sdfPadding = 4;
+const int sdfOnEdgeValue = 128;
+const float sdfPixelDistScale = float(sdfOnEdgeValue) / sdfPadding;
+
+// rasterizes ascii glyphs [32, 127) into atlas.bitmap
+// sdf - store signed distance fields instead of coverage, one atlas serves every scale
+// returns false on failure
+bool bakeFontAtlas(const unsigned char* fontData, int fontSize, int textureWidth, bool sdf,
+                   FontAtlas& atlas);
+
+// file format, the bitmap follows the header
+struct FontAtlasHeader
+{
+    char magic[4]; // FATL
+    int version;
+    int glyphSize; // sizeof(Glyph)
+    int fontSize;
+    int textureWidth;
+    int sdf;
+    // of the font file, a mismatch means the atlas is stale
+    long long sourceSize;
+    long long sourceMtime;
+    ivec2 size;
+    float lineSpace;
+    Glyph glyphs[127];
+};
+
+// "res/font.otf" -> "res/font.otf.38_512.atlas" ("res/font.otf.38_512_sdf.atlas")
+void getFontAtlasFilename(char* buffer, int bufferSize, const char* fontFilename, int fontSize,
+                          int textureWidth, bool sdf);
+
+// returns false on failure
+bool writeFontAtlas(const char* filename, const char* fontFilename, int fontSize,
+                    int textureWidth, bool sdf, const FontAtlas& atlas);
+
+// returns nullptr if data is not an up to date atlas of this font
+const FontAtlasHeader* validateFontAtlas(const unsigned char* data, int size,
+                                         const char* fontFilename, int fontSize,
+                                         int textureWidth, bool sdf);
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "Array.hpp"
+
+// linear allocator for the data that lives for one frame, reset() frees everything at once
+// when a block is full a bigger one is added, reset() merges them into a single block, so after
+// the first frames there are no mallocs at all
+// does not respect constructors & destructors
+class FrameArena
+{
+public:
+	explicit FrameArena(int blockSize = 64 * 1024) : nextBlockSize_(blockSize) {}
+
+	~FrameArena()
+	{
+		for (Block& block : blocks_)
+			free(block.data);
+	}
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	// align must be a power of 2 <= 16 (malloc alignment of the blocks)
+	void* allocate(int size, int align = 16)
+	{
+		assert(align <= 16 && (align & (align - 1)) == 0);
+		int offset = (offset_ + align - 1) & ~(align - 1);
+
+		if (blocks_.empty() || offset + size > blocks_.back().size)
+		{
+			addBlock(size);
+			offset = 0;
+			offset_ = 0;
+		}
+
+		used_ += offset + size - offset_;
+		highWater_ = used_ > highWater_ ? used_ : highWater_;
+		offset_ = offset + size;
+		return blocks_.back().data + offset;
+	}
+
+	// uninitialized
+	template<typename T>
+	T* allocate(int count)
+	{
+		return (T*)allocate(sizeof(T) * count, alignof(T) < 16 ? alignof(T) : 16);
+	}
+
+	// all the allocations are invalid after this
+	void reset()
+	{
+		if (blocks_.size() > 1)
+		{
+			int size = 0;
+
+			for (Block& block : blocks_)
+			{
+				size += block.size;
+				free(block.data);
+			}
+
+			blocks_.clear();
+			nextBlockSize_ = size;
+			addBlock(0);
+		}
+
+		offset_ = 0;
+		lastUsed_ = used_;
+		used_ = 0;
+	}
+
+	int used()      const { return used_; } // bytes, since the last reset()
+	int lastUsed()  const { return lastUsed_; } // before the last reset()
+	int highWater() const { return highWater_; } // the most used between two reset() calls
+	int capacity()  const
+	{
+		int size = 0;
+
+		for (const Block& block : blocks_)
+			size += block.size;
+
+		return size;
+	}
+
+private:
+	struct Block
+	{
+		char* data;
+		int size;
+	};
+
+	Array<Block> blocks_; // the last one is used, the others are full
+	int offset_ = 0; // in the last block
+	int used_ = 0;
+	int lastUsed_ = 0;
+	int highWater_ = 0;
+	int nextBlockSize_;
+
+	void addBlock(int minSize)
+	{
+		Block block;
+		block.size = minSize > nextBlockSize_ ? minSize : nextBlockSize_;
+		block.data = (char*)malloc(block.size);
+		assert(block.data);
+		blocks_.pushBack(block);
+		nextBlockSize_ = block.size * 2;
+	}
+};
+
+// growable array in a FrameArena, the storage is valid until the arena is reset
+// growing copies the elements into a new allocation, the old one is wasted until the reset
+// does not respect constructors & destructors
+template<typename T>
+class ArenaArray
+{
+public:
+	explicit ArenaArray(FrameArena& arena, int capacity = 16) :
+		arena_(arena),
+		data_(arena.allocate<T>(capacity)),
+		capacity_(capacity)
+	{
+		assert(capacity > 0);
+	}
+
+	void pushBack(const T& val)
+	{
+		if (size_ == capacity_)
+		{
+			T* const data = arena_.allocate<T>(capacity_ * 2);
+			memcpy(data, data_, sizeof(T) * size_);
+			data_ = data;
+			capacity_ *= 2;
+		}
+
+		data_[size_] = val;
+		++size_;
+	}
+
+	void     clear() { size_ = 0; }
+	T&       operator[](int i) { return data_[i]; }
+	const T& operator[](int i) const { return data_[i]; }
+	T*       begin() { return data_; }
+	const T* begin()           const { return data_; }
+	T*       end() { return data_ + size_; }
+	const T* end()             const { return data_ + size_; }
+	T*       data() { return data_; }
+	const T* data()            const { return data_; }
+	bool     empty()           const { return size_ == 0; }
+	int      size()            const { return size_; }
+
+private:
+	FrameArena& arena_;
+	T* data_;
+	int size_ = 0;
+	int capacity_;
+};
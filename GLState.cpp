@@ -0,0 +1,334 @@
+// GL state cache, see Scene.hpp
+
+static const int glStateMaxUnits = 4;
+
+struct GLStateCall
+{
+    enum
+    {
+        Program,
+        Texture,
+        VertexArray,
+        Buffer,
+        Capability,
+        Uniform,
+        Count
+    };
+};
+
+static const char* const glStateCallNames[GLStateCall::Count] =
+{
+    "program",
+    "texture",
+    "vertex array",
+    "array buffer",
+    "enable",
+    "uniform"
+};
+
+// the caps that are tracked, the others pass through
+static const GLenum glStateCaps[] = {GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_SCISSOR_TEST};
+
+struct UniformCacheEntry
+{
+    GLuint program;
+    char name[32];
+    GLint location;
+    int size; // of the value in bytes, 0 - unknown (not set yet or too big to cache)
+    unsigned char value[sizeof(mat4)];
+};
+
+// starts with the defaults of a new context
+static struct
+{
+    GLuint program = 0;
+    GLuint activeUnit = 0;
+    GLuint textures[glStateMaxUnits] = {};
+    GLuint vertexArray = 0;
+    GLuint arrayBuffer = 0; // not a part of the vertex array state
+    bool caps[getSize(glStateCaps)] = {};
+    Array<UniformCacheEntry> uniforms; // of all the programs, a few per program
+
+    // this frame, the last frame
+    int numIssued[GLStateCall::Count] = {};
+    int numSkipped[GLStateCall::Count] = {};
+    int lastIssued[GLStateCall::Count] = {};
+    int lastSkipped[GLStateCall::Count] = {};
+} glState;
+
+// true if the call has to be issued
+static bool glStateChanged(const int call, const bool changed)
+{
+    ++(changed ? glState.numIssued : glState.numSkipped)[call];
+    return changed;
+}
+
+void bindProgram(const GLuint program)
+{
+    if(glStateChanged(GLStateCall::Program, glState.program != program))
+    {
+        glUseProgram(program);
+        glState.program = program;
+    }
+}
+
+void bindTexture(const Texture& texture, const GLuint unit)
+{
+    assert(unit < glStateMaxUnits);
+
+    if(!glStateChanged(GLStateCall::Texture, glState.activeUnit != unit ||
+                                             glState.textures[unit] != texture.id))
+        return;
+
+    if(glState.activeUnit != unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glState.activeUnit = unit;
+    }
+
+    if(glState.textures[unit] != texture.id)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture.id);
+        glState.textures[unit] = texture.id;
+    }
+}
+
+void bindVertexArray(const GLuint vao)
+{
+    if(glStateChanged(GLStateCall::VertexArray, glState.vertexArray != vao))
+    {
+        glBindVertexArray(vao);
+        glState.vertexArray = vao;
+    }
+}
+
+void bindBuffer(const GLenum target, const GLuint buffer)
+{
+    // GL_ELEMENT_ARRAY_BUFFER is a part of the vertex array state
+    if(target != GL_ARRAY_BUFFER)
+    {
+        glBindBuffer(target, buffer);
+        return;
+    }
+
+    if(glStateChanged(GLStateCall::Buffer, glState.arrayBuffer != buffer))
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glState.arrayBuffer = buffer;
+    }
+}
+
+void setEnabled(const GLenum cap, const bool enabled)
+{
+    int idx = 0;
+
+    while(idx < getSize(glStateCaps) && glStateCaps[idx] != cap)
+        ++idx;
+
+    if(idx == getSize(glStateCaps))
+    {
+        enabled ? glEnable(cap) : glDisable(cap);
+        return;
+    }
+
+    if(glStateChanged(GLStateCall::Capability, glState.caps[idx] != enabled))
+    {
+        enabled ? glEnable(cap) : glDisable(cap);
+        glState.caps[idx] = enabled;
+    }
+}
+
+void deleteVertexArrays(const int count, const GLuint* const vaos)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        // the binding goes back to 0, the name can be returned by glGen*() again
+        if(vaos[i] == glState.vertexArray)
+            glState.vertexArray = 0;
+    }
+
+    glDeleteVertexArrays(count, vaos);
+}
+
+void deleteBuffers(const int count, const GLuint* const buffers)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        if(buffers[i] == glState.arrayBuffer)
+            glState.arrayBuffer = 0;
+    }
+
+    glDeleteBuffers(count, buffers);
+}
+
+// deleteTexture()
+static void forgetGLTexture(const GLuint id)
+{
+    for(GLuint& texture: glState.textures)
+    {
+        if(texture == id)
+            texture = 0;
+    }
+}
+
+// deleteProgram()
+static void forgetGLProgram(const GLuint program)
+{
+    if(glState.program == program)
+        glState.program = 0;
+
+    for(int i = glState.uniforms.size() - 1; i >= 0; --i)
+    {
+        if(glState.uniforms[i].program == program)
+        {
+            glState.uniforms[i] = glState.uniforms.back();
+            glState.uniforms.popBack();
+        }
+    }
+}
+
+static GLint getUniformLocation(GLuint program, const char* const name)
+{
+    GLint loc = glGetUniformLocation(program, name);
+    if(loc == -1)
+        printf("program = %u: unfiform '%s' is inactive\n", program, name);
+    return loc;
+}
+
+// returns the location, -1 if the uniform already has the value (or is inactive)
+static GLint updateUniform(const GLuint program, const char* const name,
+                           const void* const value, const int size)
+{
+    // glUniform*() sets the bound program
+    assert(program == glState.program);
+    UniformCacheEntry* entry = nullptr;
+
+    for(UniformCacheEntry& e: glState.uniforms)
+    {
+        if(e.program == program && strcmp(e.name, name) == 0)
+        {
+            entry = &e;
+            break;
+        }
+    }
+
+    if(!entry)
+    {
+        assert(strlen(name) < sizeof(entry->name));
+        glState.uniforms.pushBack({});
+        entry = &glState.uniforms.back();
+        entry->program = program;
+        strcpy(entry->name, name);
+        entry->location = getUniformLocation(program, name);
+        entry->size = 0;
+    }
+
+    if(size > int(sizeof(entry->value)))
+        entry->size = 0;
+    else if(entry->size == size && memcmp(entry->value, value, size) == 0)
+    {
+        ++glState.numSkipped[GLStateCall::Uniform];
+        return -1;
+    }
+    else
+    {
+        entry->size = size;
+        memcpy(entry->value, value, size);
+    }
+
+    ++glState.numIssued[GLStateCall::Uniform];
+    return entry->location;
+}
+
+void uniformMat4(const GLuint program, const char* const name, const mat4& m)
+{
+    const GLint loc = updateUniform(program, name, &m, sizeof(m));
+
+    if(loc != -1)
+        glUniformMatrix4fv(loc, 1, false, &m[0][0]);
+}
+
+void uniform1i(const GLuint program, const char* const name, const int i)
+{
+    const GLint loc = updateUniform(program, name, &i, sizeof(i));
+
+    if(loc != -1)
+        glUniform1i(loc, i);
+}
+
+void uniform1f(const GLuint program, const char* const name, const float f)
+{
+    const GLint loc = updateUniform(program, name, &f, sizeof(f));
+
+    if(loc != -1)
+        glUniform1f(loc, f);
+}
+
+void uniform2f(const GLuint program, const char* const name, const float f1, const float f2)
+{
+    uniform2f(program, name, vec2(f1, f2));
+}
+
+void uniform2f(const GLuint program, const char* const name, const vec2 v)
+{
+    const GLint loc = updateUniform(program, name, &v, sizeof(v));
+
+    if(loc != -1)
+        glUniform2f(loc, v.x, v.y);
+}
+
+void uniform3f(const GLuint program, const char* const name, const float f1, const float f2,
+               const float f3)
+{
+    uniform3f(program, name, vec3(f1, f2, f3));
+}
+
+void uniform3f(const GLuint program, const char* const name, const vec3 v)
+{
+    const GLint loc = updateUniform(program, name, &v, sizeof(v));
+
+    if(loc != -1)
+        glUniform3f(loc, v.x, v.y, v.z);
+}
+
+void uniform4f(const GLuint program, const char* const name, const float f1, const float f2,
+               const float f3, const float f4)
+{
+    uniform4f(program, name, vec4(f1, f2, f3, f4));
+}
+
+void uniform4f(const GLuint program, const char* const name, const vec4 v)
+{
+    const GLint loc = updateUniform(program, name, &v, sizeof(v));
+
+    if(loc != -1)
+        glUniform4f(loc, v.x, v.y, v.z, v.w);
+}
+
+void uniform4fv(const GLuint program, const char* const name, const vec4* const v,
+                const int count)
+{
+    const GLint loc = updateUniform(program, name, v, sizeof(vec4) * count);
+
+    if(loc != -1)
+        glUniform4fv(loc, count, &v->x);
+}
+
+void glStateFrame()
+{
+    memcpy(glState.lastIssued, glState.numIssued, sizeof(glState.numIssued));
+    memcpy(glState.lastSkipped, glState.numSkipped, sizeof(glState.numSkipped));
+    memset(glState.numIssued, 0, sizeof(glState.numIssued));
+    memset(glState.numSkipped, 0, sizeof(glState.numSkipped));
+}
+
+void glStateImgui()
+{
+    ImGui::Text("%-13s %7s %7s", "gl calls", "issued", "skipped");
+
+    for(int i = 0; i < GLStateCall::Count; ++i)
+    {
+        ImGui::Text("%-13s %7d %7d", glStateCallNames[i], glState.lastIssued[i],
+                    glState.lastSkipped[i]);
+    }
+}
@@ -2,7 +2,14 @@
 #include "imgui/imgui.h"
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
 #include "glad.h"
+#include "TripleBuffer.hpp"
+#include "SpscRing.hpp"
+#include "Profiler.hpp"
 
 Camera3d::Camera3d()
 {
@@ -122,6 +129,18 @@ void Camera3d::imgui()
         ImGui::Checkbox("disable flying with WS", &forwardXZonly);
 }
 
+static const vec4 tilePalette[TileColor::Count] = {
+        vec4(0.3f, 0.f, 0.5f, 1.f), // Free
+        vec4(0.f, 1.f, 1.f, 1.f),   // I
+        vec4(1.f, 1.f, 0.f, 1.f),   // O
+        vec4(1.f, 0.f, 1.f, 1.f),   // T
+        vec4(0.f, 1.f, 0.f, 1.f),   // S
+        vec4(1.f, 0.f, 0.f, 1.f),   // Z
+        vec4(0.f, 0.f, 1.f, 1.f),   // J
+        vec4(1.f, 0.5f, 0.f, 1.f),  // L
+        vec4(1.f, 1.f, 1.f, 0.4f)   // Shadow
+};
+
 bool isCollision(Tetrimino& tetrimino, const Map& map)
 {
         for (int j = 0; j < tetrimino.boxSide; ++j)
@@ -129,21 +148,75 @@ bool isCollision(Tetrimino& tetrimino, const Map& map)
                 for (int i = 0; i < tetrimino.boxSide; ++i)
                 {
                         const int idx = j * tetrimino.boxSide + i;
-                        const int tileIdx = map.size.x * (tetrimino.pos.y + j) + tetrimino.pos.x + i;
 
-                        bool tileOccupied = map.rects[tileIdx].color != map.baseColor;
+                        if (!tetrimino.box.d[idx])
+                                continue;
 
-                        if (tetrimino.box.d[idx] && (tileOccupied || tetrimino.pos.y + j == map.size.y
-                                || tetrimino.pos.x + i == map.size.x || tetrimino.pos.x + i == -1))
+                        if (tetrimino.pos.y + j == map.size.y || tetrimino.pos.x + i == map.size.x
+                                || tetrimino.pos.x + i == -1)
                         {
                                 return true;
                         }
+
+                        const int tileIdx = map.size.x * (tetrimino.pos.y + j) + tetrimino.pos.x + i;
+
+                        if (map.tiles[tileIdx] != TileColor::Free)
+                                return true;
                 }
         }
 
         return false;
 }
 
+void initMap(Map& map, const ivec2 size)
+{
+        map.size = size;
+        map.tiles.resize(size.x * size.y);
+
+        for (unsigned char& tile : map.tiles)
+                tile = TileColor::Free;
+}
+
+// uploads consecutive dirty rows of map_ with one call, does nothing if the map did not change
+// rect colors are refreshed from map_.tiles here
+void GameScene::uploadDirtyRows()
+{
+        GLint unpackAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        bindTexture(boardTexture_);
+
+        int row = 0;
+
+        while (row < map_.size.y)
+        {
+                if (!boardDirtyRows_[row])
+                {
+                        ++row;
+                        continue;
+                }
+
+                const int first = row;
+
+                while (row < map_.size.y && boardDirtyRows_[row])
+                {
+                        for (int i = row * map_.size.x; i < (row + 1) * map_.size.x; ++i)
+                                boardRects_[i].color = tilePalette[map_.tiles[i]];
+
+                        boardDirtyRows_[row] = false;
+                        ++row;
+                }
+
+                const int offset = first * map_.size.x;
+                updateSubGLBuffers(boardBuffers_, boardRects_.data() + offset, offset,
+                                   (row - first) * map_.size.x);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, map_.size.x, row - first, GL_RED_INTEGER,
+                                GL_UNSIGNED_BYTE, map_.tiles.data() + offset);
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+}
+
 Tetrimino::Box getBoxI(int rotation)
 {
         Tetrimino::Box box;
@@ -388,47 +461,41 @@ void spawnNewTetrimino(Tetrimino& t)
         t.pos = ivec2(3.f, 0.f);
         t.type = getRandomInt(0, Tetrimino::NumTypes - 1);
         t.rotation = 0;
+        t.tileColor = TileColor::I + t.type;
 
         switch (t.type)
         {
         case Tetrimino::I:;
-                t.color = vec4(0.f, 1.f, 1.f, 1.f);
                 t.boxSide = 4;
                 t.box = getBoxI(t.rotation);
                 break;
 
         case Tetrimino::O:
-                t.color = vec4(1.f, 1.f, 0.f, 1.f);
                 t.boxSide = 4;
                 t.box = getBoxO(t.rotation);
                 break;
 
         case Tetrimino::T:;
-                t.color = vec4(1.f, 0.f, 1.f, 1.f);
                 t.boxSide = 3;
                 t.box = getBoxT(t.rotation);
                 break;
 
         case Tetrimino::S:;
-                t.color = vec4(0.f, 1.f, 0.f, 1.f);
                 t.boxSide = 3;
                 t.box = getBoxS(t.rotation);
                 break;
 
         case Tetrimino::Z:;
-                t.color = vec4(1.f, 0.f, 0.f, 1.f);
                 t.boxSide = 3;
                 t.box = getBoxZ(t.rotation);
                 break;
 
         case Tetrimino::J:;
-                t.color = vec4(0.f, 0.f, 1.f, 1.f);
                 t.boxSide = 3;
                 t.box = getBoxJ(t.rotation);
                 break;
 
         case Tetrimino::L:;
-                t.color = vec4(1.f, 0.5f, 0.f, 1.f);
                 t.boxSide = 3;
                 t.box = getBoxL(t.rotation);
                 break;
@@ -683,12 +750,210 @@ static Vertex qubeModel[36] = {
 	}
 };
 
+// every qube is only translated, so a board cell is enough to place it
 struct QubeInstance
 {
-	vec4 color;
-	mat4 modelMatrix;
+	signed char x, y; // map coordinates
+	unsigned char tileColor;
+	unsigned char pad;
+};
+
+struct BoardVertex
+{
+	vec3 pos;
+	vec3 normal;
+	unsigned char tileColor;
+	unsigned char pad[3];
+};
+
+// 4 vertices and 6 indices per quad
+struct BoardMesh
+{
+	ArenaArray<BoardVertex> vertices;
+	ArenaArray<unsigned> indices; // 16 bits are not enough for big boards
 };
 
+// cross(u, v) must point in the direction of the normal (ccw winding)
+static void addBoardQuad(BoardMesh& mesh, const vec3 origin, const vec3 u, const vec3 v,
+	const vec3 normal, const int tileColor)
+{
+	const int first = mesh.vertices.size();
+	const vec3 corners[] = { origin, origin + u, origin + u + v, origin + v };
+
+	for (const vec3& corner : corners)
+		mesh.vertices.pushBack(BoardVertex{ corner, normal, (unsigned char)tileColor, {} });
+
+	const int quadIndices[] = { 0, 1, 2, 2, 3, 0 };
+
+	for (const int i : quadIndices)
+		mesh.indices.pushBack(first + i);
+}
+
+// emits only the faces not shared with other tiles, coplanar faces of the same color are merged
+// uses the same world placement as vert3d
+void GameScene::buildBoardMesh(FrameArena& arena)
+{
+	// at most 6 quads per tile
+	BoardMesh mesh = { ArenaArray<BoardVertex>(arena, map_.size.x * map_.size.y * 6 * 4),
+	                   ArenaArray<unsigned>(arena, map_.size.x * map_.size.y * 6 * 6) };
+
+	const int w = map_.size.x;
+	const int h = map_.size.y;
+
+	auto tile = [&](const int x, const int y)
+	{
+		if (x < 0 || x >= w || y < 0 || y >= h)
+			return (int)TileColor::Free;
+
+		return (int)map_.tiles[y * w + x];
+	};
+
+	// world y of the bottom of a map row
+	auto bottom = [&](const int y)
+	{
+		return h - 1 - y + 0.05f;
+	};
+
+	// front and back faces, 2d greedy meshing
+	{
+		bool* const merged = arena.allocate<bool>(w * h);
+		memset(merged, 0, w * h);
+
+		for (int y = 0; y < h; ++y)
+		{
+			for (int x = 0; x < w; ++x)
+			{
+				const int color = tile(x, y);
+
+				if (color == TileColor::Free || merged[y * w + x])
+					continue;
+
+				int sizeX = 1;
+
+				while (x + sizeX < w && tile(x + sizeX, y) == color && !merged[y * w + x + sizeX])
+					++sizeX;
+
+				int sizeY = 1;
+
+				for (; y + sizeY < h; ++sizeY)
+				{
+					bool rowMatches = true;
+
+					for (int i = x; i < x + sizeX; ++i)
+					{
+						if (tile(i, y + sizeY) != color || merged[(y + sizeY) * w + i])
+						{
+							rowMatches = false;
+							break;
+						}
+					}
+
+					if (!rowMatches)
+						break;
+				}
+
+				for (int j = y; j < y + sizeY; ++j)
+				{
+					for (int i = x; i < x + sizeX; ++i)
+						merged[j * w + i] = true;
+				}
+
+				const vec3 origin(x, bottom(y + sizeY - 1), 0.f);
+				const vec3 width(sizeX, 0.f, 0.f);
+				const vec3 height(0.f, sizeY, 0.f);
+
+				addBoardQuad(mesh, origin, width, height, vec3(0.f, 0.f, 1.f), color);
+				addBoardQuad(mesh, origin - vec3(0.f, 0.f, 1.f), height, width, vec3(0.f, 0.f, -1.f), color);
+			}
+		}
+	}
+
+	const vec3 depth(0.f, 0.f, 1.f);
+
+	// left and right faces, merged along columns
+	for (int side = -1; side <= 1; side += 2)
+	{
+		for (int x = 0; x < w; ++x)
+		{
+			int y = 0;
+
+			while (y < h)
+			{
+				const int color = tile(x, y);
+
+				if (color == TileColor::Free || tile(x + side, y) != TileColor::Free)
+				{
+					++y;
+					continue;
+				}
+
+				int size = 1;
+
+				while (y + size < h && tile(x, y + size) == color && tile(x + side, y + size) == TileColor::Free)
+					++size;
+
+				const vec3 height(0.f, size, 0.f);
+
+				if (side == 1)
+					addBoardQuad(mesh, vec3(x + 1, bottom(y + size - 1), -1.f), height, depth, vec3(1.f, 0.f, 0.f), color);
+				else
+					addBoardQuad(mesh, vec3(x, bottom(y + size - 1), -1.f), depth, height, vec3(-1.f, 0.f, 0.f), color);
+
+				y += size;
+			}
+		}
+	}
+
+	// top and bottom faces, merged along rows (map y grows down)
+	for (int side = -1; side <= 1; side += 2)
+	{
+		for (int y = 0; y < h; ++y)
+		{
+			int x = 0;
+
+			while (x < w)
+			{
+				const int color = tile(x, y);
+
+				if (color == TileColor::Free || tile(x, y + side) != TileColor::Free)
+				{
+					++x;
+					continue;
+				}
+
+				int size = 1;
+
+				while (x + size < w && tile(x + size, y) == color && tile(x + size, y + side) == TileColor::Free)
+					++size;
+
+				const vec3 width(size, 0.f, 0.f);
+
+				if (side == -1)
+					addBoardQuad(mesh, vec3(x, bottom(y) + 1.f, -1.f), depth, width, vec3(0.f, 1.f, 0.f), color);
+				else
+					addBoardQuad(mesh, vec3(x, bottom(y), -1.f), width, depth, vec3(0.f, -1.f, 0.f), color);
+
+				x += size;
+			}
+		}
+	}
+
+	boardNumVertices_ = mesh.vertices.size();
+	boardNumIndices_ = mesh.indices.size();
+
+	bindBuffer(GL_ARRAY_BUFFER, vboBoard_);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(BoardVertex) * mesh.vertices.size(), mesh.vertices.data(),
+		GL_STATIC_DRAW);
+
+	// GL_ELEMENT_ARRAY_BUFFER binding is a part of the vao state
+	bindVertexArray(vaoBoard_);
+	bindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboBoard_);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned) * mesh.indices.size(), mesh.indices.data(),
+		GL_STATIC_DRAW);
+
+	boardMeshDirty_ = false;
+}
+
 const char* const vertLines = R"(
 #version 330
 
@@ -723,11 +988,109 @@ layout(location = 1) in vec2 texCoord;
 layout(location = 2) in vec3 normal;
 
 // per instance
-layout(location = 3) in vec4 color;
-layout(location = 4) in mat4 model;
+layout(location = 3) in ivec2 cell;
+layout(location = 4) in uint tileColor;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform vec4 palette[9]; // TileColor::Count
+uniform float mapHeight;
+
+out vec3 vPos;
+out vec2 vTexCoord;
+out vec3 vNormal;
+out vec4 vColor;
+
+void main()
+{
+    // map y grows down
+    vec3 translation = vec3(0.5) + vec3(cell.x, mapHeight - 1.0 - cell.y + 0.05, -1.0);
+    vec4 pos = vec4(vertex + translation, 1.0);
+    vPos = pos.xyz;
+    gl_Position = projection * view * pos;
+    vTexCoord = texCoord;
+    vNormal = normal; // translation does not change normals
+	vColor = palette[tileColor];
+}
+)";
+
+const char* const vertBoard3d = R"(
+#version 330
+
+layout(location = 0) in vec3 vertex;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in uint tileColor;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform vec4 palette[9]; // TileColor::Count
+
+out vec3 vPos;
+out vec2 vTexCoord;
+out vec3 vNormal;
+out vec4 vColor;
+
+void main()
+{
+    vPos = vertex;
+    gl_Position = projection * view * vec4(vertex, 1.0);
+    vTexCoord = vec2(0.0);
+    vNormal = normal;
+	vColor = palette[tileColor];
+}
+)";
+
+const char* const vertBoardTex2d = R"(
+#version 330
+
+uniform usampler2D board;
+uniform vec4 palette[9]; // TileColor::Count
+uniform vec2 cameraPos;
+uniform vec2 cameraSize;
+
+out vec4 vColor;
+
+const vec2 corners[6] = vec2[](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+                               vec2(1.0, 1.0), vec2(0.0, 1.0), vec2(0.0, 0.0));
+
+void main()
+{
+    ivec2 mapSize = textureSize(board, 0);
+    ivec2 cell = ivec2(gl_InstanceID % mapSize.x, gl_InstanceID / mapSize.x);
+    vColor = palette[texelFetch(board, cell, 0).r];
+
+    // the same transformation as in the rect program
+    vec2 pos = vec2(cell) + corners[gl_VertexID];
+    pos = (pos - cameraPos) * vec2(2.0) / cameraSize + vec2(-1.0);
+    pos.y *= -1.0;
+    gl_Position = vec4(pos, 0.0, 1.0);
+}
+)";
+
+const char* const fragBoardTex2d = R"(
+#version 330
+
+in vec4 vColor;
+
+out vec4 oColor;
+
+void main()
+{
+    oColor = vColor;
+}
+)";
+
+const char* const vertBoardTex3d = R"(
+#version 330
+
+layout(location = 0) in vec3 vertex;
+layout(location = 1) in vec2 texCoord;
+layout(location = 2) in vec3 normal;
 
+uniform usampler2D board;
 uniform mat4 projection;
 uniform mat4 view;
+uniform vec4 palette[9]; // TileColor::Count
 
 out vec3 vPos;
 out vec2 vTexCoord;
@@ -736,12 +1099,25 @@ out vec4 vColor;
 
 void main()
 {
-    vec4 pos = model * vec4(vertex, 1.0);
+    ivec2 mapSize = textureSize(board, 0);
+    ivec2 cell = ivec2(gl_InstanceID % mapSize.x, gl_InstanceID / mapSize.x);
+    uint tileColor = texelFetch(board, cell, 0).r;
+
+    // free tile, every vertex ends up outside of the clip volume
+    if(tileColor == 0u)
+    {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    // the same placement as in vert3d
+    vec3 translation = vec3(0.5) + vec3(cell.x, mapSize.y - 1 - cell.y + 0.05, -1.0);
+    vec4 pos = vec4(vertex + translation, 1.0);
     vPos = pos.xyz;
     gl_Position = projection * view * pos;
     vTexCoord = texCoord;
-    vNormal = mat3(transpose(inverse(model))) * normal;
-	vColor = color;
+    vNormal = normal;
+	vColor = palette[tileColor];
 }
 )";
 
@@ -769,265 +1145,286 @@ void main()
 }
 )";
 
-GameScene::GameScene()
-{
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+// every board buffer is sized from it, big boards are drawn with the occupancy texture
+// (the qubes of the falling piece have 8-bit cells, 3d needs a board below 128 x 128)
+static const ivec2 boardSize(10, 20);
 
-        glBuffers_ = createGLBuffers();
-        font_ = createFontFromFile("res/Exo2-Black.otf", 38, 512);
+static const int simTickRate = 240; // Hz
+static const float simTickTime = 1.f / simTickRate;
+static const long long simTickNs = 1000000000 / simTickRate;
 
-		p3d_ = createProgram(vert3d, frag3d);
-		assert(p3d_);
-		programLines_ = createProgram(vertLines, fragLines);
-		assert(programLines_);
+// what GameScene::render() reads, published every tick
+struct GameSnapshot
+{
+        Array<unsigned char> tiles; // GameSimulation::map
+        Tetrimino tetrimino;
+        Tetrimino tetNext;
+        ivec2 prevPos; // tetrimino.pos in the previous tick, == pos after a spawn
+        bool gameOver;
+        bool paused;
+        int score;
+        float gravityTime;
+        long long publishTime; // getTimeNs()
+        unsigned numInputApplied; // events popped from GameSimulation::input so far
+};
 
-		glGenBuffers(1, &vboQube_);
-		glGenBuffers(1, &vboIA_);
-		glGenBuffers(1, &vboLines_);
-		glGenVertexArrays(1, &vao_);
-		glGenVertexArrays(1, &vaoLines_);
+// game logic, ticks at simTickRate on its own thread, so input handling and gravity do not
+// depend on the render frame time; with gSimulationThread == false GameScene::update() ticks it
+// with the frame time instead (game logs have to be deterministic)
+struct GameSimulation
+{
+        Map map; // only tiles
+        Tetrimino tetrimino;
+        Tetrimino tetNext;
+        bool executeStep = false;
+        float gravityTime = 0.f; // seconds since the last step
+        bool gameOver = false;
+        bool paused = false;
+        int score = 0;
+        bool spawned; // in this tick
+        bool changed = false; // since the last wake up of the main loop
+
+        // horizontal autoshift from press / release times, OS key repeat is ignored
+        // das - delay before the auto repeat, arr - interval of the repeat, 0 - to the wall at once
+        // set from the render thread (ImGui)
+        std::atomic<int> dasMs{133};
+        std::atomic<int> arrMs{33};
+        bool shiftHeld[2] = {}; // left, right
+        int shiftDir = 0; // of the key pressed last, -1, 0, 1
+        long long nextShift; // ns
+
+        // key events from GameScene::processInput(), in time order
+        SpscRing<WinEvent, 256> input;
+        long long timeNs = 0; // of the current tick, the simulation clock for game logs
+        unsigned numInputApplied = 0;
+
+        float accumulator = 0.f; // !gSimulationThread, frame time not yet ticked
+
+        TripleBuffer<GameSnapshot> snapshots;
+        std::thread thread;
+        std::atomic<bool> quit{false};
+};
 
-		glBindBuffer(GL_ARRAY_BUFFER, vboQube_);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(qubeModel), qubeModel, GL_STATIC_DRAW);
+static void restartGame(GameSimulation& sim)
+{
+        for(unsigned char& tile: sim.map.tiles)
+            tile = TileColor::Free;
 
-		glBindVertexArray(vao_);
+        spawnNewTetrimino(sim.tetrimino);
+        spawnNewTetrimino(sim.tetNext);
 
-		// pos
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), nullptr);
-		glEnableVertexAttribArray(0);
-		
-		// texCoord
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)sizeof(vec3));
-		glEnableVertexAttribArray(1);
+        sim.gameOver = false;
+        sim.paused = false;
+        sim.score = 0;
+        sim.gravityTime = 0.f;
+        sim.spawned = true;
+}
 
-		// normal
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*) (sizeof(vec3) + sizeof(vec2)) );
-		glEnableVertexAttribArray(2);
+// key press or repeat, see GameScene::processInput()
+// returns false if the tetrimino is blocked
+static bool shiftTetrimino(GameSimulation& sim, const int dir)
+{
+        sim.tetrimino.pos.x += dir;
 
-		// instanced attributes
-		glBindBuffer(GL_ARRAY_BUFFER, vboIA_);
+        if (isCollision(sim.tetrimino, sim.map))
+        {
+                sim.tetrimino.pos.x -= dir;
+                return false;
+        }
 
-		// color
-		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(QubeInstance), nullptr);
-		glEnableVertexAttribArray(3);
-		glVertexAttribDivisor(3, 1);
+        sim.changed = true;
+        return true;
+}
 
-		// model matrix
-		glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(QubeInstance), (const void*)sizeof(vec4));
-		glEnableVertexAttribArray(4);
-		glVertexAttribDivisor(4, 1);
+// the shifts due until time (ns)
+static void autoShift(GameSimulation& sim, const long long time)
+{
+        if (!sim.shiftDir)
+                return;
 
-		glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(QubeInstance), (const void*)(sizeof(vec4) * 2));
-		glEnableVertexAttribArray(5);
-		glVertexAttribDivisor(5, 1);
+        // charged, but no shifts while the game is stopped
+        if (sim.gameOver || sim.paused)
+        {
+                sim.nextShift = max(sim.nextShift, time);
+                return;
+        }
 
-		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(QubeInstance), (const void*)(sizeof(vec4) * 3));
-		glEnableVertexAttribArray(6);
-		glVertexAttribDivisor(6, 1);
+        const long long arr = sim.arrMs.load(std::memory_order_relaxed) * 1000000ll;
 
-		glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(QubeInstance), (const void*)(sizeof(vec4) * 4));
-		glEnableVertexAttribArray(7);
-		glVertexAttribDivisor(7, 1);
+        while (sim.nextShift <= time)
+        {
+                if (!arr)
+                {
+                        while (shiftTetrimino(sim, sim.shiftDir))
+                                ;
 
-		// lines
+                        // stays at the wall if the board below it changes
+                        return;
+                }
 
-		float linesData[12] = {
-			0.f, 20.f, 0.f,
-			0.f, 0.f, 0.f,
-			10.f, 0.f, 0.f,
-			10.f, 20.f, 0.f
-		};
+                shiftTetrimino(sim, sim.shiftDir);
+                sim.nextShift += arr;
+        }
+}
 
-		glBindVertexArray(vaoLines_);
+static void applyShiftKey(GameSimulation& sim, const WinEvent& event, const int dir)
+{
+        const int idx = dir > 0;
 
-		glBindBuffer(GL_ARRAY_BUFFER, vboLines_);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(linesData), linesData, GL_STATIC_DRAW);
+        if (event.key.action == GLFW_PRESS)
+        {
+                sim.shiftHeld[idx] = true;
+                sim.shiftDir = dir;
+        }
+        else if (event.key.action == GLFW_RELEASE)
+        {
+                sim.shiftHeld[idx] = false;
 
-		// pos
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-		glEnableVertexAttribArray(0);
+                if (sim.shiftDir != dir)
+                        return;
 
-        for (int y = 0; y < map_.size.y; ++y)
-        {
-                for (int x = 0; x < map_.size.x; ++x)
-                {
-                        const int idx = y * map_.size.x + x;
-                        Rect& rect = map_.rects[idx];
-                        rect.color = map_.baseColor;
-                        rect.rotation = 0.f;
-                        rect.size = vec2(1.f);
-                        rect.pos = vec2(x, y);
-                }
+                // back to the other key if it is still held
+                sim.shiftDir = sim.shiftHeld[!idx] ? -dir : 0;
+
+                if (!sim.shiftDir)
+                        return;
         }
+        else
+                return; // GLFW_REPEAT
 
-        spawnNewTetrimino(tetrimino_);
-        spawnNewTetrimino(tetNext_);
+        sim.nextShift = event.time + sim.dasMs.load(std::memory_order_relaxed) * 1000000ll;
 
-		camera_.pos = vec3(6.523, 12.832f, 10.581f);
-		camera_.pitch = -9.6f;
-		camera_.yaw = -0.5f;
+        if (!sim.gameOver && !sim.paused)
+                shiftTetrimino(sim, sim.shiftDir);
 }
 
-GameScene::~GameScene()
+static void applyGameInput(GameSimulation& sim, const WinEvent& event)
 {
-        deleteGLBuffers(glBuffers_);
-        deleteFont(font_);
+        if (event.key.key == GLFW_KEY_A || event.key.key == GLFW_KEY_LEFT)
+        {
+                applyShiftKey(sim, event, -1);
+                return;
+        }
 
-		deleteProgram(p3d_);
-		deleteProgram(programLines_);
-		glDeleteBuffers(1, &vboQube_);
-		glDeleteBuffers(1, &vboIA_);
-		glDeleteBuffers(1, &vboLines_);
-		glDeleteVertexArrays(1, &vao_);
-		glDeleteVertexArrays(1, &vaoLines_);
-}
-
-void GameScene::processInput(const Array<WinEvent>& events)
-{
-        for (const WinEvent& event : events)
+        if (event.key.key == GLFW_KEY_D || event.key.key == GLFW_KEY_RIGHT)
         {
-			if(enableCameraInput_)
-                camera_.processEvent(event);
-
-                if (event.type == WinEvent::Key && event.key.action != GLFW_RELEASE)
-                {
-                        if (event.key.key == GLFW_KEY_ESCAPE)
-                                frame_.popMe = true;
-
-                        else if (event.key.key == GLFW_KEY_ENTER && gameOver_)
-                        {
-                                for(Rect& r: map_.rects)
-                                    r.color = map_.baseColor;
-
-                                spawnNewTetrimino(tetrimino_);
-                                spawnNewTetrimino(tetNext_);
+                applyShiftKey(sim, event, 1);
+                return;
+        }
 
-                                gameOver_ = false;
-								score_ = 0;
-                        }
-						else if (event.key.key == GLFW_KEY_2)
-						{
-							render3d_ = !render3d_;
-						}
+        if (event.key.action == GLFW_RELEASE)
+                return;
 
-                        if(gameOver_)
-                            continue;
+        if (event.key.key == GLFW_KEY_ENTER && sim.gameOver)
+                restartGame(sim);
 
-                        ivec2 move(0);
+        else if (event.key.key == GLFW_KEY_P && !sim.gameOver && event.key.action == GLFW_PRESS)
+                sim.paused = !sim.paused;
 
-                        if (event.key.key == GLFW_KEY_A || event.key.key == GLFW_KEY_LEFT)
-                                move.x -= 1;
+        if(sim.gameOver || sim.paused)
+            return;
 
-                        else if (event.key.key == GLFW_KEY_D || event.key.key == GLFW_KEY_RIGHT)
-                                move.x += 1;
+        ivec2 move(0);
 
-                        else if (event.key.key == GLFW_KEY_S || event.key.key == GLFW_KEY_DOWN)
-                                move.y += 1;
+        if (event.key.key == GLFW_KEY_S || event.key.key == GLFW_KEY_DOWN)
+                move.y += 1;
 
-                        else if (event.key.key == GLFW_KEY_SPACE)
-                        {
-                                // in case while loop will break immediately
-                                tetrimino_.pos.y += 1;
+        else if (event.key.key == GLFW_KEY_SPACE)
+        {
+                // in case while loop will break immediately
+                sim.tetrimino.pos.y += 1;
 
-                                while (!isCollision(tetrimino_, map_))
-                                        tetrimino_.pos.y += 1;
+                while (!isCollision(sim.tetrimino, sim.map))
+                        sim.tetrimino.pos.y += 1;
 
-                                tetrimino_.pos.y -= 1;
-                                executeStep_ = true;
-                        }
-                        else if (event.key.key == GLFW_KEY_Z)
-                        {
-                                rotate(false, tetrimino_);
+                sim.tetrimino.pos.y -= 1;
+                sim.executeStep = true;
+        }
+        else if (event.key.key == GLFW_KEY_Z)
+        {
+                rotate(false, sim.tetrimino);
 
-                                if(isCollision(tetrimino_, map_))
-                                        rotate(true, tetrimino_);
-                        }
+                if(isCollision(sim.tetrimino, sim.map))
+                        rotate(true, sim.tetrimino);
+        }
 
-                        else if (event.key.key == GLFW_KEY_X)
-                        {
-                                rotate(true, tetrimino_);
+        else if (event.key.key == GLFW_KEY_X)
+        {
+                rotate(true, sim.tetrimino);
 
-                                if(isCollision(tetrimino_, map_))
-                                        rotate(false, tetrimino_);
-                        }
+                if(isCollision(sim.tetrimino, sim.map))
+                        rotate(false, sim.tetrimino);
+        }
 
-                        if (move.x || move.y)
-                        {
-                                tetrimino_.pos += move;
-                                if (isCollision(tetrimino_, map_))
-                                {
-                                        tetrimino_.pos -= move;
-                                        if(move.y)
-                                            executeStep_ = true;
-                                }
-                        }
+        if (move.x || move.y)
+        {
+                sim.tetrimino.pos += move;
+                if (isCollision(sim.tetrimino, sim.map))
+                {
+                        sim.tetrimino.pos -= move;
+                        if(move.y)
+                            sim.executeStep = true;
                 }
         }
 }
 
-void GameScene::update()
+// gravity, locking and line clears
+static void stepGame(GameSimulation& sim)
 {
-        camera_.update(frame_.time);
-
-        static float accumulator = 0.f;
-
-        if(gameOver_)
+        if(sim.gameOver || sim.paused)
             return;
 
-        accumulator += frame_.time;
+        sim.gravityTime += simTickTime;
 
-        if (accumulator >= 0.5f || executeStep_)
+        if (sim.gravityTime >= 0.5f || sim.executeStep)
         {
-                executeStep_ = false;
-                tetrimino_.pos.y += 1;
-                accumulator = 0.f;
+                sim.executeStep = false;
+                sim.tetrimino.pos.y += 1;
+                sim.gravityTime = 0.f;
+                sim.changed = true;
         }
         else return;
 
-        if (isCollision(tetrimino_, map_))
+        if (isCollision(sim.tetrimino, sim.map))
         {
-            tetrimino_.pos.y -= 1;
+            sim.tetrimino.pos.y -= 1;
 
-            if(tetrimino_.pos.y == 0)
+            if(sim.tetrimino.pos.y == 0)
             {
-                gameOver_ = true;
+                sim.gameOver = true;
                 return;
             }
 
-            for (int j = 0; j < tetrimino_.boxSide; ++j)
+            for (int j = 0; j < sim.tetrimino.boxSide; ++j)
             {
-                    for (int i = 0; i < tetrimino_.boxSide; ++i)
+                    for (int i = 0; i < sim.tetrimino.boxSide; ++i)
                     {
-                            const int idx = j * tetrimino_.boxSide + i;
-                            if (tetrimino_.box.d[idx])
+                            const int idx = j * sim.tetrimino.boxSide + i;
+                            if (sim.tetrimino.box.d[idx])
                             {
-                                    const int tileIdx = map_.size.x * (tetrimino_.pos.y + j) + tetrimino_.pos.x + i;
-                                    map_.rects[tileIdx].color = tetrimino_.color;
-                                    map_.rects[tileIdx].size = vec2(1.f);
-                                    map_.rects[tileIdx].rotation = 0.f;
-                                    map_.rects[tileIdx].pos = vec2(tetrimino_.pos + ivec2(i, j));
+                                    const int tileIdx = sim.map.size.x * (sim.tetrimino.pos.y + j) + sim.tetrimino.pos.x + i;
+                                    sim.map.tiles[tileIdx] = sim.tetrimino.tileColor;
                             }
                     }
             }
 
             int numCompletedRows = 0;
 
-            for (int _i = 0; _i < tetrimino_.boxSide; ++_i)
+            for (int _i = 0; _i < sim.tetrimino.boxSide; ++_i)
             {
-                const int clearRowIdx = tetrimino_.pos.y + _i;
+                const int clearRowIdx = sim.tetrimino.pos.y + _i;
 
-                    if (clearRowIdx >= map_.size.y)
+                    if (clearRowIdx >= sim.map.size.y)
                             break;
 
                     {
-                            const int rectIdx = map_.size.x * clearRowIdx;
+                            const int rectIdx = sim.map.size.x * clearRowIdx;
 
                             bool complete = true;
 
-                            for (int i = 0; i < map_.size.x; ++i)
+                            for (int i = 0; i < sim.map.size.x; ++i)
                             {
-                                    if (map_.rects[rectIdx + i].color == map_.baseColor) // is free
+                                    if (sim.map.tiles[rectIdx + i] == TileColor::Free)
                                     {
                                             complete = false;
                                             break;
@@ -1040,18 +1437,18 @@ void GameScene::update()
                             ++numCompletedRows;
 
                             // clear the completed row
-                            for (int i = 0; i < map_.size.x; ++i)
+                            for (int i = 0; i < sim.map.size.x; ++i)
                             {
-                                    map_.rects[rectIdx + i].color = map_.baseColor;
+                                    sim.map.tiles[rectIdx + i] = TileColor::Free;
                             }
                     }
 
-                    int firstNonEmptyRow = map_.size.y;
-                    for (int j = 0; j < map_.size.y; ++j)
+                    int firstNonEmptyRow = sim.map.size.y;
+                    for (int j = 0; j < sim.map.size.y; ++j)
                     {
-                            for (int i = 0; i < map_.size.x; ++i)
+                            for (int i = 0; i < sim.map.size.x; ++i)
                             {
-                                    if (map_.rects[j * map_.size.x + i].color != map_.baseColor)
+                                    if (sim.map.tiles[j * sim.map.size.x + i] != TileColor::Free)
                                     {
                                             firstNonEmptyRow = j;
                                             goto endLoop;
@@ -1065,20 +1462,21 @@ void GameScene::update()
 
                     for (int j = clearRowIdx; j > firstNonEmptyRow; --j)
                     {
-                            for (int i = 0; i < map_.size.x; ++i)
+                            for (int i = 0; i < sim.map.size.x; ++i)
                             {
-                                    const int rectIdx = j * map_.size.x + i;
-                                    map_.rects[rectIdx].color = map_.rects[rectIdx - map_.size.x].color;
+                                    const int rectIdx = j * sim.map.size.x + i;
+                                    sim.map.tiles[rectIdx] = sim.map.tiles[rectIdx - sim.map.size.x];
                             }
                     }
 
-                    for (int i = 0; i < map_.size.x; ++i)
-                            map_.rects[firstNonEmptyRow * map_.size.x + i].color = map_.baseColor;
+                    for (int i = 0; i < sim.map.size.x; ++i)
+                            sim.map.tiles[firstNonEmptyRow * sim.map.size.x + i] = TileColor::Free;
 
             }
 
-            tetrimino_ = tetNext_;
-            spawnNewTetrimino(tetNext_);
+            sim.tetrimino = sim.tetNext;
+            spawnNewTetrimino(sim.tetNext);
+            sim.spawned = true;
 
             int coeff = 0;
 
@@ -1102,30 +1500,403 @@ void GameScene::update()
 
                 }
 
-            score_ += coeff * 100;
+            sim.score += coeff * 100;
+
+        }
+}
+
+static void tickSimulation(GameSimulation& sim)
+{
+        PROFILE_SCOPE("tickSimulation");
+
+        // on the thread all queued input is in the past
+        sim.timeNs = gSimulationThread ? getTimeNs() : sim.timeNs + simTickNs;
+
+        const ivec2 prevPos = sim.tetrimino.pos;
+        sim.spawned = false;
+
+        // each event in the tick it happened in, not all of a frame at once
+        while (const WinEvent* const event = sim.input.peek())
+        {
+                if (event->time > sim.timeNs)
+                        break;
+
+                // the shifts due before a release or a direction change
+                autoShift(sim, event->time);
+                applyGameInput(sim, *event);
+                sim.input.pop();
+                ++sim.numInputApplied;
+                sim.changed = true;
+        }
+
+        autoShift(sim, sim.timeNs);
+        stepGame(sim);
+
+        GameSnapshot& snapshot = sim.snapshots.getWriteBuffer();
+        // allocates only in the first ticks, until every buffer was written once
+        snapshot.tiles.resize(sim.map.tiles.size());
+        memcpy(snapshot.tiles.data(), sim.map.tiles.data(), sim.map.tiles.size());
+        snapshot.tetrimino = sim.tetrimino;
+        snapshot.tetNext = sim.tetNext;
+        snapshot.prevPos = sim.spawned ? sim.tetrimino.pos : prevPos;
+        snapshot.gameOver = sim.gameOver;
+        snapshot.paused = sim.paused;
+        snapshot.score = sim.score;
+        snapshot.gravityTime = sim.gravityTime;
+        snapshot.publishTime = getTimeNs();
+        snapshot.numInputApplied = sim.numInputApplied;
+        sim.snapshots.publish();
+}
+
+static void simulationThreadFunc(GameSimulation* const sim)
+{
+        setThreadName("simulation");
+
+        const auto tickDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(simTickTime));
+
+        auto nextTick = std::chrono::steady_clock::now();
+
+        while (!sim->quit.load(std::memory_order_relaxed))
+        {
+                tickSimulation(*sim);
+
+                // the main loop might be sleeping in idle mode
+                if(sim->changed)
+                {
+                        sim->changed = false;
+                        glfwPostEmptyEvent();
+                }
+
+                nextTick += tickDuration;
+                const auto now = std::chrono::steady_clock::now();
 
+                // suspended or stopped in a debugger, don't catch up with a burst of ticks
+                if(now - nextTick > std::chrono::milliseconds(100))
+                        nextTick = now;
+
+                std::this_thread::sleep_until(nextTick);
+        }
+}
+
+void GameScene::prefetchPrograms()
+{
+        prefetchProgram(vert3d, frag3d);
+        prefetchProgram(vertLines, fragLines);
+        prefetchProgram(vertBoard3d, frag3d);
+        prefetchProgram(vertBoardTex2d, fragBoardTex2d);
+        prefetchProgram(vertBoardTex3d, frag3d);
+}
+
+GameScene::GameScene()
+{
+        initMap(map_, boardSize);
+        setEnabled(GL_BLEND, true);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        glBuffers_ = createGLBuffers();
+        boardBuffers_ = createGLBuffers();
+        font_ = acquireFont("res/Exo2-Black.otf", 38, 512, true, true);
+
+		p3d_ = createProgram(vert3d, frag3d);
+		assert(p3d_);
+		programLines_ = createProgram(vertLines, fragLines);
+		assert(programLines_);
+		pBoard3d_ = createProgram(vertBoard3d, frag3d);
+		assert(pBoard3d_);
+		pBoardTex2d_ = createProgram(vertBoardTex2d, fragBoardTex2d);
+		assert(pBoardTex2d_);
+		pBoardTex3d_ = createProgram(vertBoardTex3d, frag3d);
+		assert(pBoardTex3d_);
+
+		glGenBuffers(1, &vboQube_);
+		glGenBuffers(1, &vboIA_);
+		glGenBuffers(1, &vboLines_);
+		glGenVertexArrays(1, &vao_);
+		glGenVertexArrays(1, &vaoLines_);
+
+		bindBuffer(GL_ARRAY_BUFFER, vboQube_);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(qubeModel), qubeModel, GL_STATIC_DRAW);
+
+		bindVertexArray(vao_);
+
+		// pos
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), nullptr);
+		glEnableVertexAttribArray(0);
+		
+		// texCoord
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)sizeof(vec3));
+		glEnableVertexAttribArray(1);
+
+		// normal
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*) (sizeof(vec3) + sizeof(vec2)) );
+		glEnableVertexAttribArray(2);
+
+		// instanced attributes
+		bindBuffer(GL_ARRAY_BUFFER, vboIA_);
+
+		// cell
+		glVertexAttribIPointer(3, 2, GL_BYTE, sizeof(QubeInstance), nullptr);
+		glEnableVertexAttribArray(3);
+		glVertexAttribDivisor(3, 1);
+
+		// tile color
+		glVertexAttribIPointer(4, 1, GL_UNSIGNED_BYTE, sizeof(QubeInstance),
+			(const void*)offsetof(QubeInstance, tileColor));
+		glEnableVertexAttribArray(4);
+		glVertexAttribDivisor(4, 1);
+
+		// these never change
+		bindProgram(p3d_);
+		uniform4fv(p3d_, "palette", tilePalette, getSize(tilePalette));
+		uniform1f(p3d_, "mapHeight", map_.size.y);
+
+		// board mesh
+		glGenVertexArrays(1, &vaoBoard_);
+		glGenBuffers(1, &vboBoard_);
+		glGenBuffers(1, &iboBoard_);
+
+		bindVertexArray(vaoBoard_);
+		bindBuffer(GL_ARRAY_BUFFER, vboBoard_);
+
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(BoardVertex), nullptr);
+		glEnableVertexAttribArray(0);
+
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(BoardVertex),
+			(const void*)offsetof(BoardVertex, normal));
+		glEnableVertexAttribArray(1);
+
+		glVertexAttribIPointer(2, 1, GL_UNSIGNED_BYTE, sizeof(BoardVertex),
+			(const void*)offsetof(BoardVertex, tileColor));
+		glEnableVertexAttribArray(2);
+
+		bindProgram(pBoard3d_);
+		uniform4fv(pBoard3d_, "palette", tilePalette, getSize(tilePalette));
+
+		// board texture, qube vertices only (no instanced attributes)
+		glGenVertexArrays(1, &vaoBoardTex_);
+		bindVertexArray(vaoBoardTex_);
+		bindBuffer(GL_ARRAY_BUFFER, vboQube_);
+
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), nullptr);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex, texCoord));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex, normal));
+		glEnableVertexAttribArray(2);
+
+		bindProgram(pBoardTex2d_);
+		uniform4fv(pBoardTex2d_, "palette", tilePalette, getSize(tilePalette));
+		bindProgram(pBoardTex3d_);
+		uniform4fv(pBoardTex3d_, "palette", tilePalette, getSize(tilePalette));
+
+		// lines
+
+		const float w = map_.size.x;
+		const float h = map_.size.y;
+
+		float linesData[12] = {
+			0.f, h, 0.f,
+			0.f, 0.f, 0.f,
+			w, 0.f, 0.f,
+			w, h, 0.f
+		};
+
+		bindVertexArray(vaoLines_);
+
+		bindBuffer(GL_ARRAY_BUFFER, vboLines_);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(linesData), linesData, GL_STATIC_DRAW);
+
+		// pos
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+		glEnableVertexAttribArray(0);
+
+        boardRects_.resize(map_.size.x * map_.size.y);
+        boardDirtyRows_.resize(map_.size.y);
+
+        for (bool& dirty : boardDirtyRows_)
+                dirty = false;
+
+        for (int y = 0; y < map_.size.y; ++y)
+        {
+                for (int x = 0; x < map_.size.x; ++x)
+                {
+                        const int idx = y * map_.size.x + x;
+                        Rect& rect = boardRects_[idx];
+                        rect.color = tilePalette[TileColor::Free];
+                        rect.rotation = 0.f;
+                        rect.size = vec2(1.f);
+                        rect.pos = vec2(x, y);
+                }
+        }
+
+        // allocate the storage, from now on only the dirty rows are uploaded
+        updateGLBuffers(boardBuffers_, boardRects_.data(), boardRects_.size());
+
+        {
+                glGenTextures(1, &boardTexture_.id);
+                boardTexture_.size = map_.size;
+                bindTexture(boardTexture_);
+                // integer textures can't be filtered
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+                GLint unpackAlignment;
+                glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, map_.size.x, map_.size.y, 0, GL_RED_INTEGER,
+                             GL_UNSIGNED_BYTE, map_.tiles.data());
+
+                glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+        }
+
+		camera_.pos = vec3(6.523, 12.832f, 10.581f);
+		camera_.pitch = -9.6f;
+		camera_.yaw = -0.5f;
+
+        sim_ = new GameSimulation;
+        initMap(sim_->map, map_.size);
+        restartGame(*sim_);
+        // render() has a snapshot from the start
+        tickSimulation(*sim_);
+
+        if (gSimulationThread)
+                sim_->thread = std::thread(simulationThreadFunc, sim_);
+}
+
+GameScene::~GameScene()
+{
+        sim_->quit = true;
+
+        if (sim_->thread.joinable())
+                sim_->thread.join();
+
+        delete sim_;
+
+        deleteGLBuffers(glBuffers_);
+        deleteGLBuffers(boardBuffers_);
+        deleteTextCache(textCache_);
+        releaseFont(font_);
+
+		deleteProgram(p3d_);
+		deleteProgram(programLines_);
+		deleteProgram(pBoard3d_);
+		deleteProgram(pBoardTex2d_);
+		deleteProgram(pBoardTex3d_);
+		deleteTexture(boardTexture_);
+		deleteVertexArrays(1, &vaoBoardTex_);
+		deleteBuffers(1, &vboBoard_);
+		deleteBuffers(1, &iboBoard_);
+		deleteVertexArrays(1, &vaoBoard_);
+		deleteBuffers(1, &vboQube_);
+		deleteBuffers(1, &vboIA_);
+		deleteBuffers(1, &vboLines_);
+		deleteVertexArrays(1, &vao_);
+		deleteVertexArrays(1, &vaoLines_);
+}
+
+void GameScene::processInput(const Array<WinEvent>& events)
+{
+        for (const WinEvent& event : events)
+        {
+			if(enableCameraInput_)
+                camera_.processEvent(event);
+
+                if (event.type == WinEvent::Key)
+                {
+                        const bool press = event.key.action != GLFW_RELEASE;
+
+                        if (event.key.key == GLFW_KEY_ESCAPE)
+                                frame_.popMe |= press;
+
+						else if (event.key.key == GLFW_KEY_2)
+						{
+							render3d_ ^= press;
+						}
+                        // releases too, autoshift is timed from press to release
+                        else
+                        {
+                                WinEvent e = event;
+
+                                // game logs, the offset in the frame on the simulation clock
+                                if (!gSimulationThread)
+                                {
+                                        const long long age = frame_.timeNs - event.time;
+                                        const long long offset = max(0ll, (long long)(frame_.time * 1e9) - age);
+                                        e.time = sim_->timeNs + (long long)(sim_->accumulator * 1e9) + offset;
+                                }
+
+                                // the ring is full, shown in ImGui
+                                if (sim_->input.push(e))
+                                        ++frame_.numInputTaken;
+                                else
+                                        ++numInputDropped_;
+                        }
+                }
+        }
+}
+
+void GameScene::update()
+{
+        camera_.update(frame_.time);
+
+        if (!gSimulationThread)
+        {
+                sim_->accumulator += frame_.time;
+
+                while (sim_->accumulator >= simTickTime)
+                {
+                        tickSimulation(*sim_);
+                        sim_->accumulator -= simTickTime;
+                }
+        }
+
+        if (!sim_->snapshots.acquire())
+                return;
+
+        // re-upload only the rows that changed, the simulation thread publishes whole maps
+        const GameSnapshot& snapshot = sim_->snapshots.getReadBuffer();
+
+        for (int j = 0; j < map_.size.y; ++j)
+        {
+                const int offset = j * map_.size.x;
+
+                if (memcmp(map_.tiles.data() + offset, snapshot.tiles.data() + offset, map_.size.x) != 0)
+                {
+                        memcpy(map_.tiles.data() + offset, snapshot.tiles.data() + offset, map_.size.x);
+                        boardDirtyRows_[j] = true;
+                        boardMeshDirty_ = true;
+                }
         }
 }
 
 struct Tile
 {
 	ivec2 pos;
-	vec4 color;
+	int tileColor;
 };
 
-static FixedArray<Tile, 1024> tilesInfo;
-
 void GameScene::render(const GLuint program)
 {
-		tilesInfo.clear();
+		// only the tetrimino and its shadow, locked tiles are in the board mesh
+		ArenaArray<Tile> tilesInfo(*frame_.arena);
 
-		for(Rect& r: map_.rects)
-		{ 
-				if (r.color != map_.baseColor)
-					tilesInfo.pushBack(Tile{ ivec2(r.pos), r.color });
-		}
+        const GameSnapshot& snapshot = sim_->snapshots.getReadBuffer();
+        frame_.numInputRendered = snapshot.numInputApplied; // input latency
+        Tetrimino tetrimino = snapshot.tetrimino; // moved by the drop shadow search
+        const Tetrimino& tetNext = snapshot.tetNext;
+
+        // the falling piece is interpolated between the last two ticks (2d only, qubes are placed
+        // by cell)
+        const float ticks = gSimulationThread ? (getTimeNs() - snapshot.publishTime) * 1e-9 * simTickRate :
+                                                sim_->accumulator * simTickRate;
+
+        const float alpha = min(1.f, max(0.f, ticks));
+        const vec2 piecePos = vec2(snapshot.prevPos) + (vec2(tetrimino.pos) - vec2(snapshot.prevPos)) *
+                              alpha;
 
-        Rect rects[256];
+        ArenaArray<Rect> rects(*frame_.arena);
         bindProgram(program);
         Camera camera;
 
@@ -1138,32 +1909,48 @@ void GameScene::render(const GLuint program)
 
 		uniform1i(program, "mode", FragmentMode::Color);
 
+		// keep every board representation in sync, switching between them is free then
+		uploadDirtyRows();
+
 		if (!render3d_)
 		{
-			updateGLBuffers(glBuffers_, map_.rects, getSize(map_.rects));
-			renderGLBuffers(glBuffers_, getSize(map_.rects));
-		}
+			beginGpuPass(GpuPass::Board);
 
+			if (boardFromTexture_)
+			{
+				bindProgram(pBoardTex2d_);
+				uniform2f(pBoardTex2d_, "cameraPos", camera.pos);
+				uniform2f(pBoardTex2d_, "cameraSize", camera.size);
+				bindTexture(boardTexture_);
+				bindVertexArray(vaoBoardTex_);
+				glDrawArraysInstanced(GL_TRIANGLES, 0, 6, map_.size.x * map_.size.y);
+				bindProgram(program);
+			}
+			else
+				renderGLBuffers(boardBuffers_, boardRects_.size());
+
+			endGpuPass();
+		}
 
-        int rectIdx = 0;
 
         // tetrimino
-        for (int j = 0; j < tetrimino_.boxSide; ++j)
+        for (int j = 0; j < tetrimino.boxSide; ++j)
         {
-                for (int i = 0; i < tetrimino_.boxSide; ++i)
+                for (int i = 0; i < tetrimino.boxSide; ++i)
                 {
-                        if (tetrimino_.box.d[j * tetrimino_.boxSide + i])
+                        if (tetrimino.box.d[j * tetrimino.boxSide + i])
                         {
-                                rects[rectIdx].color = tetrimino_.color;
-                                rects[rectIdx].size = vec2(1.f);
-                                rects[rectIdx].rotation = 0.f;
-                                rects[rectIdx].pos = vec2(tetrimino_.pos + ivec2(i, j));
+                                Rect rect;
+                                rect.color = tilePalette[tetrimino.tileColor];
+                                rect.size = vec2(1.f);
+                                rect.rotation = 0.f;
+                                rect.pos = piecePos + vec2(ivec2(i, j));
 
 
-								tilesInfo.pushBack( Tile{ tetrimino_.pos + ivec2(i, j), rects[rectIdx].color } );
+								tilesInfo.pushBack( Tile{ tetrimino.pos + ivec2(i, j), tetrimino.tileColor } );
 
 								if(!render3d_)
-									++rectIdx;
+									rects.pushBack(rect);
 
                         }
                 }
@@ -1171,51 +1958,52 @@ void GameScene::render(const GLuint program)
 
         // next tetrimino
 
-        for (int j = 0; j < tetNext_.boxSide; ++j)
+        for (int j = 0; j < tetNext.boxSide; ++j)
         {
-                for (int i = 0; i < tetNext_.boxSide; ++i)
+                for (int i = 0; i < tetNext.boxSide; ++i)
                 {
-                        if (tetNext_.box.d[j * tetNext_.boxSide + i])
+                        if (tetNext.box.d[j * tetNext.boxSide + i])
                         {
-                                rects[rectIdx].color = tetNext_.color;
-                                rects[rectIdx].size = vec2(1.f);
-                                rects[rectIdx].rotation = 0.f;
-                                rects[rectIdx].pos = vec2(ivec2(map_.size.x + 2, 2) + ivec2(i, j));
-                                ++rectIdx;
+                                Rect rect;
+                                rect.color = tilePalette[tetNext.tileColor];
+                                rect.size = vec2(1.f);
+                                rect.rotation = 0.f;
+                                rect.pos = vec2(ivec2(map_.size.x + 2, 2) + ivec2(i, j));
+                                rects.pushBack(rect);
                         }
                 }
         }
 
         // drop shadow
-        const ivec2 savePos = tetrimino_.pos;
+        const ivec2 savePos = tetrimino.pos;
 
         // in case while loop will break immediately
-        tetrimino_.pos.y += 1;
+        tetrimino.pos.y += 1;
 
-        while(!isCollision(tetrimino_, map_))
-            tetrimino_.pos.y += 1;
+        while(!isCollision(tetrimino, map_))
+            tetrimino.pos.y += 1;
 
-        tetrimino_.pos.y -= 1;
+        tetrimino.pos.y -= 1;
 
-        ivec2 shadowPos = tetrimino_.pos;
-        tetrimino_.pos = savePos;
+        ivec2 shadowPos = tetrimino.pos;
+        tetrimino.pos = savePos;
 
-        for (int j = 0; j < tetrimino_.boxSide; ++j)
+        for (int j = 0; j < tetrimino.boxSide; ++j)
         {
-                for (int i = 0; i < tetrimino_.boxSide; ++i)
+                for (int i = 0; i < tetrimino.boxSide; ++i)
                 {
-                        if (tetrimino_.box.d[j * tetrimino_.boxSide + i])
+                        if (tetrimino.box.d[j * tetrimino.boxSide + i])
                         {
                                 ivec2 shadowTilePos(shadowPos + ivec2(i, j));
                                 vec4 color(0.f, 0.f, 0.f, 0.5f);
 
-                                for (int j2 = 0; j2 < tetrimino_.boxSide; ++j2)
+                                for (int j2 = 0; j2 < tetrimino.boxSide; ++j2)
                                 {
-                                    for (int i2 = 0; i2 < tetrimino_.boxSide; ++i2)
+                                    for (int i2 = 0; i2 < tetrimino.boxSide; ++i2)
                                     {
-                                        if(tetrimino_.box.d[tetrimino_.boxSide * j2 + i2])
+                                        if(tetrimino.box.d[tetrimino.boxSide * j2 + i2])
                                         {
-                                            ivec2 tilePos = tetrimino_.pos + ivec2(i2, j2);
+                                            ivec2 tilePos = tetrimino.pos + ivec2(i2, j2);
 
                                             if(tilePos == shadowTilePos)
                                                 color = vec4(0.f);
@@ -1224,84 +2012,126 @@ void GameScene::render(const GLuint program)
                                 }
 
 
-                                rects[rectIdx].color = color;
-                                rects[rectIdx].size = vec2(1.f);
-                                rects[rectIdx].rotation = 0.f;
-                                rects[rectIdx].pos = vec2(shadowTilePos);
+                                Rect rect;
+                                rect.color = color;
+                                rect.size = vec2(1.f);
+                                rect.rotation = 0.f;
+                                rect.pos = vec2(shadowTilePos);
 
-								tilesInfo.pushBack( Tile{ shadowTilePos, vec4(1.f, 1.f, 1.f, 0.4f) } );
+								tilesInfo.pushBack( Tile{ shadowTilePos, TileColor::Shadow } );
 
 								if(!render3d_)
-									++rectIdx;
+									rects.pushBack(rect);
                         }
                 }
         }
 
-        updateGLBuffers(glBuffers_, rects, rectIdx);
-        renderGLBuffers(glBuffers_, rectIdx);
+        beginGpuPass(GpuPass::Pieces);
+        updateGLBuffers(glBuffers_, rects.data(), rects.size());
+        renderGLBuffers(glBuffers_, rects.size());
+        endGpuPass();
 
 		// render3d
 		if(render3d_)
 		{
+			mat4 projection = perspective(45.f, frame_.fbSize.x / frame_.fbSize.y, 0.1f, 100.f);
+
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+			// back faces, counter-clockwise front (the defaults)
+			setEnabled(GL_DEPTH_TEST, true);
+			setEnabled(GL_CULL_FACE, true);
+
+			// locked tiles
+			beginGpuPass(GpuPass::Board);
+
+			if (boardFromTexture_)
+			{
+				bindProgram(pBoardTex3d_);
+				uniformMat4(pBoardTex3d_, "view", camera_.view);
+				uniformMat4(pBoardTex3d_, "projection", projection);
+				uniform3f(pBoardTex3d_, "lightPos", vec3(6.f, 6.f, 10.f));
+
+				bindTexture(boardTexture_);
+				bindVertexArray(vaoBoardTex_);
+				glDrawArraysInstanced(GL_TRIANGLES, 0, 36, map_.size.x * map_.size.y);
+			}
+			else
+			{
+				if (boardMeshDirty_)
+					buildBoardMesh(*frame_.arena);
+
+				bindProgram(pBoard3d_);
+				uniformMat4(pBoard3d_, "view", camera_.view);
+				uniformMat4(pBoard3d_, "projection", projection);
+				uniform3f(pBoard3d_, "lightPos", vec3(6.f, 6.f, 10.f));
+
+				bindVertexArray(vaoBoard_);
+				glDrawElements(GL_TRIANGLES, boardNumIndices_, GL_UNSIGNED_INT, nullptr);
+			}
+
+			endGpuPass();
+			beginGpuPass(GpuPass::Qubes);
 			bindProgram(p3d_);
 			uniformMat4(p3d_, "view", camera_.view);
-
-			mat4 projection = perspective(45.f, frame_.fbSize.x / frame_.fbSize.y, 0.1f, 100.f);
 			uniformMat4(p3d_, "projection", projection);
 			uniform3f(p3d_, "lightPos", vec3(6.f, 6.f, 10.f));
 
-			static float time = 0.f;
-			time += frame_.time * 10.f;
-			
 			{
-				static FixedArray<QubeInstance, 1024> instances;
-				instances.clear();
+				ArenaArray<QubeInstance> instances(*frame_.arena, tilesInfo.size() + 1);
 
 				for (Tile& t : tilesInfo)
+					instances.pushBack(QubeInstance{ (signed char)t.pos.x, (signed char)t.pos.y, (unsigned char)t.tileColor, 0 });
+
+				// 40 x 25 additional qubes to the left and right of the map
+				if (benchQubes_)
 				{
-					QubeInstance i;
-					i.color = t.color;
-					i.modelMatrix = translate(vec3(0.5) + vec3(t.pos.x, 19 - t.pos.y + 0.05f, -1.f));
-					instances.pushBack(i);
+					for (int y = 0; y < 25; ++y)
+					{
+						for (int x = 0; x < 40; ++x)
+						{
+							const int cellX = x < 20 ? x - 21 : x - 20 + map_.size.x + 1;
+							instances.pushBack(QubeInstance{ (signed char)cellX, (signed char)(y - 5),
+								(unsigned char)(TileColor::I + (x + y) % Tetrimino::NumTypes), 0 });
+						}
+					}
 				}
 
-				glBindBuffer(GL_ARRAY_BUFFER, vboIA_);
+				bindBuffer(GL_ARRAY_BUFFER, vboIA_);
 				glBufferData(GL_ARRAY_BUFFER, sizeof(QubeInstance) * instances.size(), instances.data(), GL_STREAM_DRAW);
 
-				glBindVertexArray(vao_);
-
-				glClear(GL_DEPTH_BUFFER_BIT);
-
-				glEnable(GL_DEPTH_TEST);
-				glEnable(GL_CULL_FACE);
-
-				glCullFace(GL_BACK);
-				glFrontFace(GL_CCW);
+				bindVertexArray(vao_);
 
 				// draw qubes
 				glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instances.size());
 			}
 
-			// draw lines
+			endGpuPass();
 
+			// draw lines
+			beginGpuPass(GpuPass::Lines);
 			bindProgram(programLines_);
 			uniformMat4(programLines_, "view", camera_.view);
 			uniformMat4(programLines_, "projection", projection);
 
-			glBindVertexArray(vaoLines_);
+			bindVertexArray(vaoLines_);
 
 			glDrawArrays(GL_LINE_STRIP, 0, 4);
+			endGpuPass();
 
-			glDisable(GL_DEPTH_TEST);
-			glDisable(GL_CULL_FACE);
+			setEnabled(GL_DEPTH_TEST, false);
+			setEnabled(GL_CULL_FACE, false);
 
 			bindProgram(program);
 		}
 
-        int textCount = 0;
+        // text meshes are laid out only when they are not in textCache_
+        beginGpuPass(GpuPass::Text);
+        uniform1i(program, "mode", getFragmentMode(*font_));
+        bindTexture(font_->texture);
 
         // game over text
-        if(gameOver_)
+        if(snapshot.gameOver)
         {
             static float accumulator = 0.f;
             static bool show = true;
@@ -1318,40 +2148,46 @@ void GameScene::render(const GLuint program)
             text.str = "Game Over. Press ENTER to start new game!";
             text.scale = 0.04f;
 
-            const vec2 size = getTextSize(text, font_);
-
-            text.pos = ( vec2(map_.size) - (size + vec2(0.5f)) ) / vec2(2.f);
+            const TextMesh& mesh = getTextMesh(textCache_, text, *font_);
+            const vec2 pos = ( vec2(map_.size) - (mesh.size + vec2(0.5f)) ) / vec2(2.f);
 
             if(show)
             {
                 Text text2 =  text;
                 text2.color = vec4(1.f, 0.f, 0.f, 1.f);
-                text2.pos.y += 0.1f;
 
-                textCount += writeTextToBuffer(text2, font_, rects, getSize(rects));
+                renderTextMesh(program, getTextMesh(textCache_, text2, *font_), pos + vec2(0.f, 0.1f),
+                               camera);
             }
 
-            textCount += writeTextToBuffer(text, font_, rects + textCount, getSize(rects));
+            renderTextMesh(program, getTextMesh(textCache_, text, *font_), pos, camera);
+        }
+        else if(snapshot.paused)
+        {
+            Text text;
+            text.color = { 1.f, 1.f, 1.f, 1.f };
+            text.str = "Paused. Press P to resume.";
+            text.scale = 0.04f;
 
+            const TextMesh& mesh = getTextMesh(textCache_, text, *font_);
+            const vec2 pos = ( vec2(map_.size) - (mesh.size + vec2(0.5f)) ) / vec2(2.f);
+            renderTextMesh(program, mesh, pos, camera);
         }
 
         // render score
         {
+            if(snapshot.score != scoreText_.score)
+            {
+                scoreText_.score = snapshot.score;
+                sprintf(scoreText_.str, "score: %d", snapshot.score);
+            }
+
             Text text;
-            char buff[126];
-            sprintf(buff, "score: %d", score_);
             text.color = { 1.f, 1.f, 1.f, 1.f };
-            text.str = buff;
+            text.str = scoreText_.str;
             text.scale = 0.04f;
 
-            text.pos = vec2(-10, 8);
-
-            textCount += writeTextToBuffer(text, font_, rects + textCount, getSize(rects));
-            
-            uniform1i(program, "mode", FragmentMode::Font);
-            bindTexture(font_.texture);
-            updateGLBuffers(glBuffers_, rects, textCount);
-            renderGLBuffers(glBuffers_, textCount);
+            renderTextMesh(program, getTextMesh(textCache_, text, *font_), vec2(-10, 8), camera);
         }
 
         // render random text
@@ -1362,18 +2198,50 @@ void GameScene::render(const GLuint program)
 
         Text text;
         text.color = { 1.f, 1.f, 0.f, 1.f };
-        text.pos = vec2(50.f, 600.f);
         text.str = "T E T R I S  3D\nHELL YEA!\n\npress 2 to switch\nbetween 2d and 3d";
 
-        textCount = writeTextToBuffer(text, font_, rects, getSize(rects));
-        uniform1i(program, "mode", FragmentMode::Font);
-        bindTexture(font_.texture);
-        updateGLBuffers(glBuffers_, rects, textCount);
-        renderGLBuffers(glBuffers_, textCount);
+        renderTextMesh(program, getTextMesh(textCache_, text, *font_), vec2(50.f, 600.f), camera);
+        endGpuPass();
 
 		ImGui::Begin("main");
 		ImGui::Spacing();
 		ImGui::Checkbox("enable camera input", &enableCameraInput_);
-			camera_.imgui();
+		ImGui::Checkbox("1000 qube benchmark (3d)", &benchQubes_);
+		ImGui::Checkbox("board from the occupancy texture", &boardFromTexture_);
+
+		// the log has only the key events, a replay would diverge after a change
+		if (isGameLogActive())
+		{
+			ImGui::Text("DAS %d ms, ARR %d ms (fixed in game logs)", sim_->dasMs.load(),
+			            sim_->arrMs.load());
+		}
+		else
+		{
+			int das = sim_->dasMs;
+			int arr = sim_->arrMs;
+
+			if (ImGui::SliderInt("DAS ms", &das, 0, 300))
+				sim_->dasMs = das;
+
+			if (ImGui::SliderInt("ARR ms (0 - instant)", &arr, 0, 100))
+				sim_->arrMs = arr;
+		}
+
+		ImGui::Text("input events dropped: %d", numInputDropped_);
+
+		if (!boardFromTexture_)
+			ImGui::Text("board mesh: %d vertices, %d indices", boardNumVertices_, boardNumIndices_);
+
+		camera_.imgui();
 		ImGui::End();
+
+        // idle mode, the next gravity step or game over text blink
+        if(enableCameraInput_ || (alpha < 1.f && snapshot.prevPos != tetrimino.pos))
+            frame_.nextChange = 0.f; // fly camera, interpolation
+        else if(snapshot.gameOver)
+            frame_.nextChange = 1.f;
+        else if(snapshot.paused)
+            frame_.nextChange = 10.f;
+        else
+            frame_.nextChange = 0.5f - snapshot.gravityTime;
 }
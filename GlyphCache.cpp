@@ -0,0 +1,456 @@
+// include stb_truetype.h first (unity build)
+// glyphs outside of the baked ascii range, see getGlyph() in Scene.hpp
+//
+// the font texture reserves glyphCacheNumPages pages below the baked atlas, glyphs are
+// rasterized on the first use and shelf packed into a page (stb_rect_pack packs whole batches,
+// we get one glyph at a time), only the glyph rectangle is uploaded
+// when all pages are full the least recently used page is cleared, its glyphs are rasterized
+// again on the next use
+// pages used in the current frame are never cleared, text meshes of the frame already point
+// into them, a glyph that finds no page is drawn as '?' and rasterized on a later frame
+
+#include <stdio.h>
+#include <string.h>
+
+const int glyphCacheNumPages = 4;
+const int glyphCachePageHeight = 128;
+const int glyphCacheTableSize = 1024; // power of 2
+
+struct GlyphCache
+{
+    struct Entry
+    {
+        int codepoint; // 0 - free
+        int page; // -1 - no such glyph in the font, the fallback is used
+                  // -2 - no page to evict in this frame (not stored)
+        Glyph glyph;
+    };
+
+    struct Page
+    {
+        int y; // in the font texture
+        int shelfY;
+        int shelfHeight;
+        int penX;
+        int lastUse;
+        int lastFrame;
+        bool used;
+    };
+
+    char filename[256];
+    int fontSize;
+    bool sdf;
+    ivec2 textureSize;
+
+    // loaded on the first miss
+    bool fontLoaded;
+    bool fontValid;
+    MappedFile fontFile;
+    stbtt_fontinfo fontInfo;
+    float scale;
+    float ascent;
+
+    Entry entries[glyphCacheTableSize]; // open addressing
+    int numEntries;
+    Page pages[glyphCacheNumPages];
+    int useCounter;
+    int generation;
+};
+
+// see glyphCacheFrame(), 0 is never current
+static int glyphCacheCurrentFrame = 1;
+
+// atlasHeight - of the baked ascii region
+static GlyphCache* createGlyphCache(const char* const filename, const int fontSize,
+                                    const bool sdf, const int textureWidth,
+                                    const int atlasHeight)
+{
+    GlyphCache* const cache = new GlyphCache;
+    snprintf(cache->filename, sizeof(cache->filename), "%s", filename);
+    cache->fontSize = fontSize;
+    cache->sdf = sdf;
+    cache->textureSize.x = textureWidth;
+    cache->textureSize.y = atlasHeight + glyphCacheNumPages * glyphCachePageHeight;
+    cache->fontLoaded = false;
+    cache->fontValid = false;
+    cache->fontFile = {nullptr, 0, nullptr};
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->numEntries = 0;
+
+    for(int i = 0; i < glyphCacheNumPages; ++i)
+    {
+        GlyphCache::Page& page = cache->pages[i];
+        page = {};
+        page.y = atlasHeight + i * glyphCachePageHeight;
+    }
+
+    cache->useCounter = 0;
+    cache->generation = 0;
+    return cache;
+}
+
+static void deleteGlyphCache(GlyphCache* const cache)
+{
+    unmapFile(cache->fontFile);
+    delete cache;
+}
+
+static GlyphCache::Entry& findGlyphCacheEntry(GlyphCache& cache, const int codepoint)
+{
+    const int mask = glyphCacheTableSize - 1;
+    int idx = (codepoint * 2654435761u) & mask;
+
+    while(cache.entries[idx].codepoint && cache.entries[idx].codepoint != codepoint)
+        idx = (idx + 1) & mask;
+
+    return cache.entries[idx];
+}
+
+static bool loadGlyphCacheFont(GlyphCache& cache)
+{
+    // stb_truetype reads the glyphs straight from the mapping
+    cache.fontFile = mapFile(cache.filename);
+
+    if(!cache.fontFile.data)
+    {
+        printf("glyph cache could not open file: %s\n", cache.filename);
+        return false;
+    }
+
+    if(stbtt_InitFont(&cache.fontInfo, cache.fontFile.data, 0) == 0)
+    {
+        printf("stbtt_InitFont() failed: %s\n", cache.filename);
+        return false;
+    }
+
+    cache.scale = stbtt_ScaleForPixelHeight(&cache.fontInfo, cache.fontSize);
+    int ascent, descent, lineGap;
+    stbtt_GetFontVMetrics(&cache.fontInfo, &ascent, &descent, &lineGap);
+    cache.ascent = ascent * cache.scale;
+    return true;
+}
+
+static void clearGlyphCachePage(GlyphCache& cache, GlyphCache::Page& page)
+{
+    // filtering samples the 1 pixel gaps between the glyphs, they have to be empty
+    static unsigned char zeros[4096 * glyphCachePageHeight];
+    assert(cache.textureSize.x <= 4096);
+
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, page.y, cache.textureSize.x, glyphCachePageHeight,
+                    GL_RED, GL_UNSIGNED_BYTE, zeros);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+    page.shelfY = 0;
+    page.shelfHeight = 0;
+    page.penX = 0;
+    page.used = true;
+}
+
+static void evictGlyphCachePage(GlyphCache& cache, const int pageIdx)
+{
+    // rebuild the table without the glyphs of the page (no tombstones)
+    static GlyphCache::Entry kept[glyphCacheTableSize];
+    int numKept = 0;
+
+    for(GlyphCache::Entry& entry: cache.entries)
+    {
+        if(entry.codepoint && entry.page != pageIdx)
+            kept[numKept++] = entry;
+
+        entry.codepoint = 0;
+    }
+
+    for(int i = 0; i < numKept; ++i)
+        findGlyphCacheEntry(cache, kept[i].codepoint) = kept[i];
+
+    cache.numEntries = numKept;
+    ++cache.generation;
+}
+
+// returns the page index or -1, pos - in the font texture
+static int allocateGlyphRect(GlyphCache& cache, const ivec2 size, ivec2& pos)
+{
+    assert(size.x <= cache.textureSize.x && size.y <= glyphCachePageHeight);
+
+    // the current shelf, a new shelf, the next page (empty)
+    for(int i = 0; i < glyphCacheNumPages; ++i)
+    {
+        GlyphCache::Page& page = cache.pages[i];
+
+        if(!page.used)
+            clearGlyphCachePage(cache, page);
+
+        // the glyph does not fit on the current shelf, open a new one below it
+        if(page.penX + size.x > cache.textureSize.x || size.y > page.shelfHeight)
+        {
+            const int shelfY = page.penX ? page.shelfY + page.shelfHeight + 1 : page.shelfY;
+
+            if(shelfY + size.y > glyphCachePageHeight)
+                continue;
+
+            page.shelfY = shelfY;
+            page.shelfHeight = size.y;
+            page.penX = 0;
+        }
+
+        pos = {page.penX, page.y + page.shelfY};
+        page.penX += size.x + 1;
+        return i;
+    }
+
+    int lru = -1;
+
+    for(int i = 0; i < glyphCacheNumPages; ++i)
+    {
+        const GlyphCache::Page& page = cache.pages[i];
+
+        if(page.lastFrame == glyphCacheCurrentFrame)
+            continue;
+
+        if(lru == -1 || page.lastUse < cache.pages[lru].lastUse)
+            lru = i;
+    }
+
+    if(lru == -1)
+        return -1;
+
+    evictGlyphCachePage(cache, lru);
+    GlyphCache::Page& page = cache.pages[lru];
+    clearGlyphCachePage(cache, page);
+    page.shelfHeight = size.y;
+    pos = {0, page.y};
+    page.penX = size.x + 1;
+    return lru;
+}
+
+// returns false if the font has no such glyph
+static bool rasterizeGlyph(GlyphCache& cache, const Texture& texture, const int codepoint,
+                           GlyphCache::Entry& entry)
+{
+    const int idx = stbtt_FindGlyphIndex(&cache.fontInfo, codepoint);
+
+    if(idx == 0)
+        return false;
+
+    Glyph& glyph = entry.glyph;
+    glyph = {};
+
+    {
+        int advance, dummy;
+        stbtt_GetGlyphHMetrics(&cache.fontInfo, idx, &advance, &dummy);
+        glyph.advance = advance * cache.scale;
+    }
+
+    static Array<unsigned char> bitmap;
+    unsigned char* sdfBitmap = nullptr;
+    ivec2 topLeft, size;
+
+    if(cache.sdf)
+    {
+        // stb returns before writing the offsets for empty glyphs (space)
+        size = {0, 0};
+        topLeft = {0, 0};
+        sdfBitmap = stbtt_GetGlyphSDF(&cache.fontInfo, cache.scale, idx, sdfPadding,
+                                      sdfOnEdgeValue, sdfPixelDistScale, &size.x, &size.y,
+                                      &topLeft.x, &topLeft.y);
+    }
+    else
+    {
+        ivec2 bottomRight;
+        stbtt_GetGlyphBitmapBox(&cache.fontInfo, idx, cache.scale, cache.scale, &topLeft.x,
+                                &topLeft.y, &bottomRight.x, &bottomRight.y);
+        size = bottomRight - topLeft;
+    }
+
+    glyph.offset.x = topLeft.x;
+    glyph.offset.y = cache.ascent + topLeft.y;
+
+    // glyphs with no shape (space) take no space in the atlas
+    if(size.x <= 0 || size.y <= 0)
+    {
+        entry.page = glyphCacheNumPages; // never evicted
+        return true;
+    }
+
+    if(size.x > cache.textureSize.x || size.y > glyphCachePageHeight)
+    {
+        printf("glyph %d does not fit in the glyph cache page\n", codepoint);
+
+        if(sdfBitmap)
+            stbtt_FreeSDF(sdfBitmap, nullptr);
+
+        return false;
+    }
+
+    // allocateGlyphRect() might clear a page
+    bindTexture(texture);
+    ivec2 pos;
+    entry.page = allocateGlyphRect(cache, size, pos);
+
+    if(entry.page == -1)
+    {
+        entry.page = -2;
+
+        if(sdfBitmap)
+            stbtt_FreeSDF(sdfBitmap, nullptr);
+
+        return true;
+    }
+
+    glyph.texRect = {float(pos.x), float(pos.y), float(size.x), float(size.y)};
+
+    const unsigned char* data = sdfBitmap;
+
+    if(!cache.sdf)
+    {
+        bitmap.resize(size.x * size.y);
+        stbtt_MakeGlyphBitmap(&cache.fontInfo, bitmap.data(), size.x, size.y, size.x,
+                              cache.scale, cache.scale, idx);
+        data = bitmap.data();
+    }
+
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, pos.x, pos.y, size.x, size.y, GL_RED, GL_UNSIGNED_BYTE,
+                    data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+    if(sdfBitmap)
+        stbtt_FreeSDF(sdfBitmap, nullptr);
+
+    return true;
+}
+
+const Glyph& getGlyph(const Font& font, const int codepoint)
+{
+    if(codepoint >= 32 && codepoint < 127)
+        return font.glyphs[codepoint];
+
+    const Glyph& fallback = font.glyphs[int('?')];
+    GlyphCache* const cache = font.glyphCache;
+
+    if(!cache || codepoint <= 0)
+        return fallback;
+
+    ++cache->useCounter;
+    GlyphCache::Entry* entry = &findGlyphCacheEntry(*cache, codepoint);
+
+    if(!entry->codepoint)
+    {
+        if(!cache->fontLoaded)
+        {
+            cache->fontLoaded = true;
+
+            cache->fontValid = loadGlyphCacheFont(*cache);
+        }
+
+        // keep the load factor <= 0.5, the whole table goes (rare)
+        // pages used in this frame keep their pixels, new glyphs are appended
+        if(cache->numEntries >= glyphCacheTableSize / 2)
+        {
+            for(int i = 0; i < glyphCacheNumPages; ++i)
+            {
+                if(cache->pages[i].lastFrame != glyphCacheCurrentFrame)
+                    cache->pages[i].used = false;
+            }
+
+            for(GlyphCache::Entry& e: cache->entries)
+                e.codepoint = 0;
+
+            cache->numEntries = 0;
+            ++cache->generation;
+            entry = &findGlyphCacheEntry(*cache, codepoint);
+        }
+
+        GlyphCache::Entry newEntry;
+        newEntry.codepoint = codepoint;
+
+        if(!cache->fontValid || !rasterizeGlyph(*cache, font.texture, codepoint, newEntry))
+            newEntry.page = -1;
+
+        // text laid out with the fallback is laid out again on a later frame
+        if(newEntry.page == -2)
+        {
+            ++cache->generation;
+            return fallback;
+        }
+
+        // rasterizeGlyph() might have evicted a page and rebuilt the table
+        entry = &findGlyphCacheEntry(*cache, codepoint);
+        *entry = newEntry;
+        ++cache->numEntries;
+    }
+
+    if(entry->page == -1)
+        return fallback;
+
+    if(entry->page < glyphCacheNumPages)
+    {
+        cache->pages[entry->page].lastUse = cache->useCounter;
+        cache->pages[entry->page].lastFrame = glyphCacheCurrentFrame;
+    }
+
+    return entry->glyph;
+}
+
+int getGlyphCacheGeneration(const Font& font)
+{
+    return font.glyphCache ? font.glyphCache->generation : 0;
+}
+
+void glyphCacheFrame()
+{
+    ++glyphCacheCurrentFrame;
+}
+
+int decodeUtf8(const char*& str)
+{
+    const unsigned char* s = (const unsigned char*)str;
+    const int c = s[0];
+    int codepoint, numBytes;
+
+    if(c < 0x80)
+    {
+        codepoint = c;
+        numBytes = 1;
+    }
+    else if((c & 0xE0) == 0xC0)
+    {
+        codepoint = c & 0x1F;
+        numBytes = 2;
+    }
+    else if((c & 0xF0) == 0xE0)
+    {
+        codepoint = c & 0x0F;
+        numBytes = 3;
+    }
+    else if((c & 0xF8) == 0xF0)
+    {
+        codepoint = c & 0x07;
+        numBytes = 4;
+    }
+    else
+    {
+        ++str;
+        return 0xFFFD;
+    }
+
+    for(int i = 1; i < numBytes; ++i)
+    {
+        // truncated sequence, don't skip the terminator
+        if((s[i] & 0xC0) != 0x80)
+        {
+            str += i;
+            return 0xFFFD;
+        }
+
+        codepoint = (codepoint << 6) | (s[i] & 0x3F);
+    }
+
+    str += numBytes;
+    return codepoint;
+}
@@ -0,0 +1,125 @@
+// gpu time of the render passes, see Scene.hpp
+
+static const char* const gpuPassNames[GpuPass::Count] =
+{
+    "board",
+    "pieces",
+    "qubes",
+    "lines",
+    "text",
+    "ImGui"
+};
+
+// a frame of queries is read gpuTimerRingSize - 1 frames after it was issued, the results are
+// there by then (the swap chain is not deeper), a query that is still not done is skipped
+static const int gpuTimerRingSize = 3;
+static const int gpuTimerWindow = 30; // frames averaged for the display
+
+static struct
+{
+    GLuint queries[gpuTimerRingSize][GpuPass::Count];
+    bool issued[gpuTimerRingSize][GpuPass::Count];
+    int frameIdx = 0; // slot of the current frame
+    int numFrames = 0;
+    int activePass = -1;
+
+    float sums[GpuPass::Count];
+    int counts[GpuPass::Count];
+    int windowFrames;
+    float avgMs[GpuPass::Count]; // -1 - not rendered in the last window
+} gpuTimer;
+
+void initGpuTimers()
+{
+    glGenQueries(gpuTimerRingSize * GpuPass::Count, &gpuTimer.queries[0][0]);
+    memset(gpuTimer.issued, 0, sizeof(gpuTimer.issued));
+    memset(gpuTimer.sums, 0, sizeof(gpuTimer.sums));
+    memset(gpuTimer.counts, 0, sizeof(gpuTimer.counts));
+    gpuTimer.windowFrames = 0;
+
+    for(float& ms: gpuTimer.avgMs)
+        ms = -1.f;
+}
+
+void deleteGpuTimers()
+{
+    glDeleteQueries(gpuTimerRingSize * GpuPass::Count, &gpuTimer.queries[0][0]);
+}
+
+void beginGpuPass(const int pass)
+{
+    // GL_TIME_ELAPSED queries can't nest
+    assert(gpuTimer.activePass == -1);
+    gpuTimer.activePass = pass;
+    gpuTimer.issued[gpuTimer.frameIdx][pass] = true;
+    glBeginQuery(GL_TIME_ELAPSED, gpuTimer.queries[gpuTimer.frameIdx][pass]);
+}
+
+void endGpuPass()
+{
+    assert(gpuTimer.activePass != -1);
+    gpuTimer.activePass = -1;
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+void gpuTimersFrame()
+{
+    assert(gpuTimer.activePass == -1);
+    gpuTimer.frameIdx = (gpuTimer.frameIdx + 1) % gpuTimerRingSize;
+    ++gpuTimer.numFrames;
+
+    // the oldest frame, its slot is reused by the next one
+    if(gpuTimer.numFrames >= gpuTimerRingSize)
+    {
+        bool* const issued = gpuTimer.issued[gpuTimer.frameIdx];
+
+        for(int i = 0; i < GpuPass::Count; ++i)
+        {
+            if(!issued[i])
+                continue;
+
+            issued[i] = false;
+            const GLuint query = gpuTimer.queries[gpuTimer.frameIdx][i];
+            GLint available;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+            if(!available)
+                continue;
+
+            GLuint64 ns;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            gpuTimer.sums[i] += ns / 1000000.f;
+            ++gpuTimer.counts[i];
+        }
+    }
+
+    ++gpuTimer.windowFrames;
+
+    if(gpuTimer.windowFrames == gpuTimerWindow)
+    {
+        for(int i = 0; i < GpuPass::Count; ++i)
+        {
+            gpuTimer.avgMs[i] = gpuTimer.counts[i] ? gpuTimer.sums[i] / gpuTimer.counts[i] : -1.f;
+            gpuTimer.sums[i] = 0.f;
+            gpuTimer.counts[i] = 0;
+        }
+
+        gpuTimer.windowFrames = 0;
+    }
+}
+
+void gpuTimersImgui()
+{
+    float sum = 0.f;
+
+    for(const float ms: gpuTimer.avgMs)
+        sum += max(0.f, ms);
+
+    ImGui::Text("gpu   %.3f", sum);
+
+    for(int i = 0; i < GpuPass::Count; ++i)
+    {
+        if(gpuTimer.avgMs[i] >= 0.f)
+            ImGui::Text("  %-8s %.3f", gpuPassNames[i], gpuTimer.avgMs[i]);
+    }
+}
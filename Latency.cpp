@@ -0,0 +1,199 @@
+// input latency measurement, see Scene.hpp
+
+static const char* const latencyStageNames[LatencyStage::Count] =
+{
+    "poll",
+    "processInput",
+    "update",
+    "render",
+    "swap",
+    "gpu",
+    "end to end"
+};
+
+static const float latencyBucketMs = 0.25f;
+static const int latencyNumBuckets = 400; // the last one counts everything above 100 ms
+static const int latencyMaxFrames = 30; // a sample whose input is not rendered by then is dropped
+
+static struct
+{
+    bool active = false;
+    FILE* csv = nullptr;
+    bool inSample = false;
+    long long inputTime;
+    long long stageTimes[LatencyStage::Count]; // EndToEnd unused
+    unsigned inputTarget; // Scene::frame_.numInputTaken after processInput()
+    int numFrames; // of the sample, > 1 when the scene applies the input later
+    int histograms[LatencyStage::Count][latencyNumBuckets];
+    int numSamples;
+    float lastMs[LatencyStage::Count];
+} latency;
+
+bool startLatencyMeasurement(const char* const csvFilename)
+{
+    assert(!latency.active);
+    latency.csv = fopen(csvFilename, "w");
+
+    if(!latency.csv)
+    {
+        printf("startLatencyMeasurement() could not open file: %s\n", csvFilename);
+        return false;
+    }
+
+    fprintf(latency.csv, "sample,frames");
+
+    for(const char* const name: latencyStageNames)
+        fprintf(latency.csv, ",%s ms", name);
+
+    fprintf(latency.csv, "\n");
+
+    latency.active = true;
+    latency.inSample = false;
+    resetLatencyHistograms();
+    return true;
+}
+
+void stopLatencyMeasurement()
+{
+    if(!latency.active)
+        return;
+
+    fclose(latency.csv);
+    latency.csv = nullptr;
+    latency.active = false;
+    latency.inSample = false;
+}
+
+bool isMeasuringLatency()
+{
+    return latency.active;
+}
+
+bool isInLatencySample()
+{
+    return latency.inSample;
+}
+
+void resetLatencyHistograms()
+{
+    memset(latency.histograms, 0, sizeof(latency.histograms));
+    memset(latency.lastMs, 0, sizeof(latency.lastMs));
+    latency.numSamples = 0;
+}
+
+void beginLatencySample(const long long inputTime)
+{
+    // the previous sample still waits for its input to be rendered
+    if(!latency.active || latency.inSample)
+        return;
+
+    latency.inSample = true;
+    latency.inputTime = inputTime;
+    latency.inputTarget = 0;
+    latency.numFrames = 1;
+}
+
+void markLatencyStage(const int stage)
+{
+    assert(stage < LatencyStage::EndToEnd);
+
+    // the input stages only in the first frame of the sample
+    if(latency.inSample && (latency.numFrames == 1 || stage > LatencyStage::Update))
+        latency.stageTimes[stage] = getTimeNs();
+}
+
+void setLatencyInputTarget(const unsigned numInputTaken)
+{
+    if(latency.inSample && latency.numFrames == 1)
+        latency.inputTarget = numInputTaken;
+}
+
+void endLatencySample(const unsigned numInputRendered)
+{
+    if(!latency.inSample)
+        return;
+
+    if(int(numInputRendered - latency.inputTarget) < 0)
+    {
+        ++latency.numFrames;
+
+        // the scene changed or the input was dropped
+        if(latency.numFrames > latencyMaxFrames)
+            latency.inSample = false;
+
+        return;
+    }
+
+    latency.inSample = false;
+    ++latency.numSamples;
+    fprintf(latency.csv, "%d,%d", latency.numSamples, latency.numFrames);
+
+    long long prevTime = latency.inputTime;
+
+    for(int i = 0; i < LatencyStage::Count; ++i)
+    {
+        long long time;
+
+        if(i == LatencyStage::EndToEnd)
+        {
+            prevTime = latency.inputTime;
+            time = latency.stageTimes[LatencyStage::Gpu];
+        }
+        else
+            time = latency.stageTimes[i];
+
+        const float ms = (time - prevTime) / 1000000.f;
+        prevTime = time;
+
+        latency.lastMs[i] = ms;
+        ++latency.histograms[i][max(0, min(latencyNumBuckets - 1, int(ms / latencyBucketMs)))];
+        fprintf(latency.csv, ",%.3f", ms);
+    }
+
+    fprintf(latency.csv, "\n");
+}
+
+// upper bound of the bucket that holds the percentile
+static float getLatencyPercentile(const int* const histogram, const float percentile)
+{
+    const int target = ceilf(latency.numSamples * percentile);
+    int count = 0;
+
+    for(int i = 0; i < latencyNumBuckets; ++i)
+    {
+        count += histogram[i];
+
+        if(count >= target)
+            return (i + 1) * latencyBucketMs;
+    }
+
+    return latencyNumBuckets * latencyBucketMs;
+}
+
+void latencyImgui()
+{
+    ImGui::Text("input latency ms, %d samples", latency.numSamples);
+    ImGui::Text("render - until the first frame that shows the input");
+
+    if(!latency.numSamples)
+        return;
+
+    ImGui::Text("%-13s %7s %7s %7s %7s", "stage", "last", "p50", "p95", "p99");
+
+    for(int i = 0; i < LatencyStage::Count; ++i)
+    {
+        ImGui::Text("%-13s %7.2f %7.2f %7.2f %7.2f", latencyStageNames[i], latency.lastMs[i],
+                    getLatencyPercentile(latency.histograms[i], 0.5f),
+                    getLatencyPercentile(latency.histograms[i], 0.95f),
+                    getLatencyPercentile(latency.histograms[i], 0.99f));
+    }
+
+    // end to end up to 50 ms
+    static float buckets[200];
+
+    for(int i = 0; i < getSize(buckets); ++i)
+        buckets[i] = latency.histograms[LatencyStage::EndToEnd][i];
+
+    ImGui::PlotHistogram("", buckets, getSize(buckets), 0, "end to end, 0 - 50 ms", 0.f,
+                         FLT_MAX, {0, 60});
+}
@@ -0,0 +1,303 @@
+// see Profiler.hpp
+
+#ifdef PROFILER
+
+#include <mutex>
+#include <string.h>
+
+static const int profileMaxThreads = 16;
+static const int profileMaxZones = 64;
+static const int profileHistorySize = 120; // frames
+
+struct ProfileZoneStats
+{
+    const char* name;
+    float history[profileHistorySize]; // ms per frame, the calls on all threads summed
+    int numFrames; // since the zone was first seen, <= profileHistorySize
+    float frameMs;
+};
+
+struct ProfileFrameEvent
+{
+    ProfileEvent event;
+    int thread;
+};
+
+static struct
+{
+    std::mutex mutex; // registration, names
+    ProfileThread* threads[profileMaxThreads];
+    std::atomic<int> numThreads{0};
+
+    // main thread only
+    unsigned numRead[profileMaxThreads] = {};
+    long long frameBegin = 0;
+    ProfileZoneStats zones[profileMaxZones];
+    int numZones = 0;
+    int historyIdx = 0; // next
+
+    // the last frame, for the flame graph
+    Array<ProfileFrameEvent> frameEvents;
+    long long lastFrameBegin = 0;
+    long long lastFrameEnd = 1;
+    bool freeze = false;
+    int selectedZone = 0;
+} profiler;
+
+// releases the slot when the thread exits
+struct ProfileThreadHandle
+{
+    ProfileThread* thread = nullptr;
+
+    ~ProfileThreadHandle()
+    {
+        if(thread)
+            thread->alive.store(false, std::memory_order_release);
+    }
+};
+
+static thread_local ProfileThreadHandle profileThreadHandle;
+
+ProfileThread& getProfileThread()
+{
+    if(profileThreadHandle.thread)
+        return *profileThreadHandle.thread;
+
+    std::lock_guard<std::mutex> lock(profiler.mutex);
+    const int numThreads = profiler.numThreads.load(std::memory_order_relaxed);
+    ProfileThread* thread = nullptr;
+
+    // the event stream of a reused slot just continues
+    for(int i = 0; i < numThreads; ++i)
+    {
+        if(!profiler.threads[i]->alive.load(std::memory_order_acquire))
+        {
+            thread = profiler.threads[i];
+            snprintf(thread->name, sizeof(thread->name), "thread %d", i);
+            break;
+        }
+    }
+
+    if(!thread)
+    {
+        assert(numThreads < profileMaxThreads);
+        thread = new ProfileThread;
+        thread->numEvents.store(0, std::memory_order_relaxed);
+        snprintf(thread->name, sizeof(thread->name), "thread %d", numThreads);
+        profiler.threads[numThreads] = thread;
+        profiler.numThreads.store(numThreads + 1, std::memory_order_release);
+    }
+
+    thread->depth = 0;
+    thread->traceThread = getTraceThreadId();
+    thread->alive.store(true, std::memory_order_relaxed);
+    profileThreadHandle.thread = thread;
+    return *thread;
+}
+
+void setProfileThreadName(const char* const name)
+{
+    ProfileThread& thread = getProfileThread();
+    std::lock_guard<std::mutex> lock(profiler.mutex);
+    snprintf(thread.name, sizeof(thread.name), "%s", name);
+}
+
+static ProfileZoneStats* findProfileZone(const char* const name)
+{
+    for(int i = 0; i < profiler.numZones; ++i)
+    {
+        ProfileZoneStats& zone = profiler.zones[i];
+
+        if(zone.name == name || strcmp(zone.name, name) == 0)
+            return &zone;
+    }
+
+    if(profiler.numZones == profileMaxZones)
+        return nullptr;
+
+    ProfileZoneStats& zone = profiler.zones[profiler.numZones];
+    ++profiler.numZones;
+    memset(&zone, 0, sizeof(zone));
+    zone.name = name;
+    return &zone;
+}
+
+void profileFrame()
+{
+    const long long now = getProfileTime();
+
+    if(!profiler.freeze)
+        profiler.frameEvents.clear();
+
+    const int numThreads = profiler.numThreads.load(std::memory_order_acquire);
+
+    for(int i = 0; i < numThreads; ++i)
+    {
+        const ProfileThread& thread = *profiler.threads[i];
+        const unsigned numEvents = thread.numEvents.load(std::memory_order_acquire);
+        unsigned& numRead = profiler.numRead[i];
+
+        // overwritten before they were read
+        if(numEvents - numRead > unsigned(profileRingSize))
+            numRead = numEvents - profileRingSize;
+
+        for(; numRead != numEvents; ++numRead)
+        {
+            const ProfileEvent& event = thread.events[numRead & (profileRingSize - 1)];
+
+            if(ProfileZoneStats* const zone = findProfileZone(event.name))
+                zone->frameMs += (event.end - event.begin) / 1000000.f;
+
+            if(!profiler.freeze)
+                profiler.frameEvents.pushBack({event, i});
+
+            if(isTracing())
+                traceThreadEvent(thread.traceThread, event.name, event.begin, event.end);
+        }
+    }
+
+    for(int i = 0; i < profiler.numZones; ++i)
+    {
+        ProfileZoneStats& zone = profiler.zones[i];
+        zone.history[profiler.historyIdx] = zone.frameMs;
+        zone.numFrames = min(profileHistorySize, zone.numFrames + 1);
+        zone.frameMs = 0.f;
+    }
+
+    profiler.historyIdx = (profiler.historyIdx + 1) % profileHistorySize;
+
+    if(!profiler.freeze && profiler.frameBegin)
+    {
+        profiler.lastFrameBegin = profiler.frameBegin;
+        profiler.lastFrameEnd = now;
+    }
+
+    profiler.frameBegin = now;
+}
+
+static ImU32 getProfileZoneColor(const char* name)
+{
+    unsigned hash = 2166136261u;
+
+    for(; *name; ++name)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+
+    return ImColor::HSV((hash % 360) / 360.f, 0.55f, 0.75f);
+}
+
+// a lane per thread, a row per nesting level, the width is the last frame
+static void profilerFlameGraph()
+{
+    ImDrawList* const drawList = ImGui::GetWindowDrawList();
+    const float width = ImGui::GetContentRegionAvailWidth();
+    const float rowHeight = ImGui::GetTextLineHeight() + 4.f;
+    const long long frameTime = max(1ll, profiler.lastFrameEnd - profiler.lastFrameBegin);
+    const double scale = width / double(frameTime);
+    const int numThreads = profiler.numThreads.load(std::memory_order_acquire);
+
+    for(int t = 0; t < numThreads; ++t)
+    {
+        int maxDepth = -1;
+
+        for(const ProfileFrameEvent& e: profiler.frameEvents)
+        {
+            if(e.thread == t)
+                maxDepth = max(maxDepth, e.event.depth);
+        }
+
+        if(maxDepth == -1)
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock(profiler.mutex);
+            ImGui::Text("%s", profiler.threads[t]->name);
+        }
+
+        const ImVec2 origin = ImGui::GetCursorScreenPos();
+        ImGui::Dummy({width, (maxDepth + 1) * rowHeight});
+
+        for(const ProfileFrameEvent& e: profiler.frameEvents)
+        {
+            if(e.thread != t)
+                continue;
+
+            const long long begin = max(0ll, e.event.begin - profiler.lastFrameBegin);
+            const long long end = min(frameTime, e.event.end - profiler.lastFrameBegin);
+
+            if(end <= begin)
+                continue;
+
+            const ImVec2 p0 = {origin.x + float(begin * scale),
+                               origin.y + e.event.depth * rowHeight};
+
+            const ImVec2 p1 = {max(p0.x + 1.f, origin.x + float(end * scale)),
+                               p0.y + rowHeight - 1.f};
+
+            drawList->AddRectFilled(p0, p1, getProfileZoneColor(e.event.name));
+
+            if(ImGui::CalcTextSize(e.event.name).x < p1.x - p0.x - 4.f)
+                drawList->AddText({p0.x + 2.f, p0.y + 2.f}, 0xFFFFFFFF, e.event.name);
+
+            if(ImGui::IsMouseHoveringRect(p0, p1))
+            {
+                ImGui::SetTooltip("%s %.3f ms", e.event.name,
+                                  (e.event.end - e.event.begin) / 1000000.f);
+            }
+        }
+    }
+}
+
+void profilerImgui(bool* const open)
+{
+    if(!ImGui::Begin("profiler", open))
+    {
+        ImGui::End();
+        return;
+    }
+
+    ImGui::Checkbox("freeze", &profiler.freeze);
+    ImGui::SameLine();
+    ImGui::Text("frame %.3f ms", (profiler.lastFrameEnd - profiler.lastFrameBegin) /
+                                 1000000.f);
+
+    profilerFlameGraph();
+
+    ImGui::Spacing();
+    ImGui::Separator();
+    ImGui::Text("%-24s %8s %8s %8s", "ms / frame", "min", "avg", "max");
+
+    for(int i = 0; i < profiler.numZones; ++i)
+    {
+        const ProfileZoneStats& zone = profiler.zones[i];
+        float minMs = FLT_MAX;
+        float maxMs = 0.f;
+        float sum = 0.f;
+
+        for(int j = 0; j < zone.numFrames; ++j)
+        {
+            const float ms = zone.history[(profiler.historyIdx - 1 - j + profileHistorySize) %
+                                          profileHistorySize];
+            minMs = min(minMs, ms);
+            maxMs = max(maxMs, ms);
+            sum += ms;
+        }
+
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%-24s %8.3f %8.3f %8.3f", zone.name, minMs,
+                 sum / max(1, zone.numFrames), maxMs);
+
+        if(ImGui::Selectable(buf, profiler.selectedZone == i))
+            profiler.selectedZone = i;
+    }
+
+    if(profiler.selectedZone < profiler.numZones)
+    {
+        const ProfileZoneStats& zone = profiler.zones[profiler.selectedZone];
+        ImGui::PlotLines("", zone.history, profileHistorySize, profiler.historyIdx, zone.name,
+                         0.f, FLT_MAX, {0, 60});
+    }
+
+    ImGui::End();
+}
+
+#endif
@@ -0,0 +1,96 @@
+#pragma once
+
+// scoped CPU timing zones
+// {
+//     PROFILE_SCOPE("update");
+//     ...
+// }
+// every thread writes the zones it leaves into its own ring buffer, the main thread collects
+// them once per frame (profileFrame()) for the flame graph and the per zone statistics
+// compiled out completely with NDEBUG (the macros expand to nothing), define PROFILE_RELEASE to
+// keep it (the zones in release traces, see startTrace())
+
+#if !defined(NDEBUG) || defined(PROFILE_RELEASE)
+#define PROFILER
+#endif
+
+#ifdef PROFILER
+
+#include <atomic>
+#include <chrono>
+
+struct ProfileEvent
+{
+    const char* name; // string literal
+    long long begin; // ns, getProfileTime()
+    long long end;
+    int depth; // of the nesting on the thread
+};
+
+static const int profileRingSize = 1 << 14;
+
+struct ProfileThread
+{
+    char name[32];
+    ProfileEvent events[profileRingSize];
+    // written, events[numEvents % profileRingSize] is the next one
+    std::atomic<unsigned> numEvents;
+    int depth;
+    std::atomic<bool> alive; // slots of finished threads are reused
+    int traceThread; // getTraceThreadId()
+};
+
+// of the calling thread, registered on the first call
+ProfileThread& getProfileThread();
+// shown in the flame graph, "thread N" by default
+void setProfileThreadName(const char* name);
+
+inline long long getProfileTime()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* const name):
+        thread_(getProfileThread()),
+        name_(name),
+        depth_(thread_.depth++),
+        begin_(getProfileTime())
+    {}
+
+    ~ProfileScope()
+    {
+        const long long end = getProfileTime();
+        --thread_.depth;
+        const unsigned idx = thread_.numEvents.load(std::memory_order_relaxed);
+        thread_.events[idx & (profileRingSize - 1)] = {name_, begin_, end, depth_};
+        thread_.numEvents.store(idx + 1, std::memory_order_release);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    ProfileThread& thread_;
+    const char* const name_;
+    const int depth_;
+    const long long begin_;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+// main thread, at the start of every frame
+void profileFrame();
+// the profiler window
+void profilerImgui(bool* open);
+
+#else
+
+#define PROFILE_SCOPE(name)
+
+#endif
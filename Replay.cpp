@@ -0,0 +1,123 @@
+// game logs, see Scene.hpp
+
+struct ReplayHeader
+{
+    char magic[4]; // "TREP"
+    int version;
+    unsigned seed;
+};
+
+static const int replayVersion = 2;
+
+// per frame: float dt, long long timeNs, int numEvents, WinEvent events[numEvents]
+
+static struct
+{
+    FILE* recordFile = nullptr;
+    FILE* replayFile = nullptr;
+} replay;
+
+bool startRecording(const char* const filename, const unsigned seed)
+{
+    assert(!replay.recordFile);
+    replay.recordFile = fopen(filename, "wb");
+
+    if(!replay.recordFile)
+    {
+        printf("startRecording() could not open file: %s\n", filename);
+        return false;
+    }
+
+    ReplayHeader header;
+    memcpy(header.magic, "TREP", 4);
+    header.version = replayVersion;
+    header.seed = seed;
+    fwrite(&header, sizeof(header), 1, replay.recordFile);
+    return true;
+}
+
+void recordFrame(const float dt, const long long timeNs, const Array<WinEvent>& events)
+{
+    if(!replay.recordFile)
+        return;
+
+    int numEvents = 0;
+
+    for(const WinEvent& e: events)
+        numEvents += e.type != WinEvent::Nil;
+
+    fwrite(&dt, sizeof(dt), 1, replay.recordFile);
+    fwrite(&timeNs, sizeof(timeNs), 1, replay.recordFile);
+    fwrite(&numEvents, sizeof(numEvents), 1, replay.recordFile);
+
+    for(const WinEvent& e: events)
+    {
+        if(e.type != WinEvent::Nil)
+            fwrite(&e, sizeof(e), 1, replay.recordFile);
+    }
+}
+
+void stopRecording()
+{
+    if(!replay.recordFile)
+        return;
+
+    fclose(replay.recordFile);
+    replay.recordFile = nullptr;
+}
+
+bool startReplay(const char* const filename, unsigned& seed)
+{
+    assert(!replay.replayFile);
+    replay.replayFile = fopen(filename, "rb");
+
+    if(!replay.replayFile)
+    {
+        printf("startReplay() could not open file: %s\n", filename);
+        return false;
+    }
+
+    ReplayHeader header;
+
+    if(fread(&header, sizeof(header), 1, replay.replayFile) != 1 ||
+       memcmp(header.magic, "TREP", 4) != 0 || header.version != replayVersion)
+    {
+        printf("startReplay() invalid file: %s\n", filename);
+        stopReplay();
+        return false;
+    }
+
+    seed = header.seed;
+    return true;
+}
+
+bool replayFrame(float& dt, long long& timeNs, Array<WinEvent>& events)
+{
+    if(!replay.replayFile)
+        return false;
+
+    int numEvents;
+
+    if(fread(&dt, sizeof(dt), 1, replay.replayFile) != 1 ||
+       fread(&timeNs, sizeof(timeNs), 1, replay.replayFile) != 1 ||
+       fread(&numEvents, sizeof(numEvents), 1, replay.replayFile) != 1 || numEvents < 0)
+        return false;
+
+    events.resize(numEvents);
+    return fread(events.data(), sizeof(WinEvent), numEvents, replay.replayFile) ==
+           size_t(numEvents);
+}
+
+void stopReplay()
+{
+    if(!replay.replayFile)
+        return;
+
+    fclose(replay.replayFile);
+    replay.replayFile = nullptr;
+}
+
+bool isGameLogActive()
+{
+    return replay.recordFile || replay.replayFile;
+}
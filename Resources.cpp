@@ -0,0 +1,620 @@
+// shared resources, see Scene.hpp
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct Resource
+{
+    enum Type
+    {
+        Font,
+        Texture,
+        Sound
+    };
+
+    // Loading -> Loaded (worker thread) -> Ready (GL thread)
+    // async uploads go through a pixel buffer: Loaded -> Staging (GL thread mapped it) ->
+    // Staged (worker thread copied the pixels) -> Ready (GL thread, a later frame)
+    enum State
+    {
+        Loading,
+        Loaded,
+        Staging,
+        Staged,
+        Ready
+    };
+
+    Type type;
+    char filename[256];
+    int params[3]; // creation parameters, part of the key
+    int refCount;
+    bool keepAlive;
+    State state; // guarded by loader.mutex until Ready
+
+    ::Font font;
+    ::Texture texture;
+    FMOD_SOUND* sound;
+    MappedFile soundFile; // fmod reads from it until the sound is released
+
+    // CPU side, filled by a worker thread
+    FontData fontData;
+    ImageData imageData;
+
+    // Staging, Staged - mapped GL_PIXEL_UNPACK_BUFFER
+    GLuint pbo;
+    void* stagingPtr;
+};
+
+// pointers, handles have to stay valid when the array grows
+static Array<Resource*> resources;
+
+static Resource* findResource(const Resource::Type type, const char* const filename,
+                              const int param0, const int param1, const int param2)
+{
+    for(Resource* r: resources)
+    {
+        if(r->type == type && r->params[0] == param0 && r->params[1] == param1 &&
+           r->params[2] == param2 && strcmp(r->filename, filename) == 0)
+            return r;
+    }
+
+    return nullptr;
+}
+
+static Resource* addResource(const Resource::Type type, const char* const filename,
+                             const int param0, const int param1, const int param2,
+                             const bool keepAlive)
+{
+    assert(strlen(filename) < sizeof(Resource::filename));
+
+    Resource* const r = new Resource;
+    r->type = type;
+    strcpy(r->filename, filename);
+    r->params[0] = param0;
+    r->params[1] = param1;
+    r->params[2] = param2;
+    r->refCount = 1;
+    r->keepAlive = keepAlive;
+    r->state = Resource::Ready;
+    r->sound = nullptr;
+    r->soundFile = {nullptr, 0, nullptr};
+    resources.pushBack(r);
+    return r;
+}
+
+// thread pool for acquire*Async()
+static struct
+{
+    std::mutex mutex;
+    std::condition_variable workAdded;
+    std::condition_variable workDone;
+    std::thread threads[4];
+    int numThreads = 0;
+    bool quit = false;
+    Array<Resource*> queue; // Loading (load) or Staging (copy), FIFO
+    Array<Resource*> loaded; // Loaded or Staged, waiting for the GL thread
+    Array<GLuint> pbos; // not mapped, reused
+} loader;
+
+// any thread
+static void loadResourceData(Resource& r)
+{
+    const long long begin = getTimeNs();
+
+    switch(r.type)
+    {
+        case Resource::Font:
+            loadFontData(r.filename, r.params[0], r.params[1], r.params[2], r.fontData);
+            break;
+
+        case Resource::Texture:
+            loadImageData(r.filename, r.imageData);
+            break;
+
+        case Resource::Sound:
+            assert(false);
+    }
+
+    traceEvent("load", r.filename, begin, getTimeNs());
+}
+
+// the pixels that go to the texture, nullptr if the load failed
+static const void* getUploadData(const Resource& r, int& size)
+{
+    switch(r.type)
+    {
+        case Resource::Font:
+            size = r.fontData.atlas.size.x * r.fontData.atlas.size.y;
+            return r.fontData.bitmap;
+
+        case Resource::Texture:
+            size = r.imageData.size.x * r.imageData.size.y * 4;
+            return r.imageData.pixels;
+
+        case Resource::Sound:
+            assert(false);
+    }
+
+    return nullptr;
+}
+
+// any thread, r is Staging
+static void copyToStagingBuffer(Resource& r)
+{
+    PROFILE_SCOPE("copyToStagingBuffer");
+    int size;
+    const void* const data = getUploadData(r, size);
+    memcpy(r.stagingPtr, data, size);
+}
+
+static void loaderThreadFunc()
+{
+    setThreadName("loader");
+
+    std::unique_lock<std::mutex> lock(loader.mutex);
+
+    while(true)
+    {
+        loader.workAdded.wait(lock, []{return loader.quit || loader.queue.size();});
+
+        if(loader.quit)
+            return;
+
+        Resource* const r = loader.queue.front();
+
+        for(int i = 1; i < loader.queue.size(); ++i)
+            loader.queue[i - 1] = loader.queue[i];
+
+        loader.queue.popBack();
+        const bool copy = r->state == Resource::Staging;
+
+        lock.unlock();
+
+        if(copy)
+            copyToStagingBuffer(*r);
+        else
+        {
+            PROFILE_SCOPE("loadResourceData");
+            loadResourceData(*r);
+        }
+
+        lock.lock();
+
+        r->state = copy ? Resource::Staged : Resource::Loaded;
+        loader.loaded.pushBack(r);
+        loader.workDone.notify_all();
+    }
+}
+
+static void queueResource(Resource* const r)
+{
+    if(!loader.numThreads)
+    {
+        const int numCores = std::thread::hardware_concurrency();
+        // the main thread keeps one core
+        loader.numThreads = max(1, min(getSize(loader.threads), numCores - 1));
+
+        for(int i = 0; i < loader.numThreads; ++i)
+            loader.threads[i] = std::thread(loaderThreadFunc);
+    }
+
+    r->state = Resource::Loading;
+    std::lock_guard<std::mutex> lock(loader.mutex);
+    loader.queue.pushBack(r);
+    loader.workAdded.notify_one();
+}
+
+// GL thread, r is Loaded, maps a pixel buffer for a worker thread to copy the pixels into
+// returns false if there is nothing to upload or the mapping failed, upload directly then
+static bool beginStagedUpload(Resource& r)
+{
+    int size;
+
+    if(!getUploadData(r, size))
+        return false;
+
+    if(loader.pbos.empty())
+    {
+        GLuint pbo;
+        glGenBuffers(1, &pbo);
+        loader.pbos.pushBack(pbo);
+    }
+
+    r.pbo = loader.pbos.back();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r.pbo);
+    // orphaned, the driver might still read the previous upload from it
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    r.stagingPtr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if(!r.stagingPtr)
+    {
+        printf("beginStagedUpload() could not map the pixel buffer, uploading directly\n");
+        return false;
+    }
+
+    loader.pbos.popBack();
+    return true;
+}
+
+// GL thread, r is Loaded or Staged and removed from loader.loaded
+// Loaded - uploaded from the CPU side data, Staged - from r.pbo
+static void uploadResource(Resource& r)
+{
+    bool staged = false;
+
+    if(r.state == Resource::Staged)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r.pbo);
+        // GL_FALSE - the contents were lost while mapped, the CPU side data is still there
+        staged = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        if(!staged)
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        loader.pbos.pushBack(r.pbo);
+    }
+
+    switch(r.type)
+    {
+        case Resource::Font:
+            r.font = createFontFromData(r.fontData, staged);
+            freeFontData(r.fontData);
+            break;
+
+        case Resource::Texture:
+            r.texture = createTextureFromData(r.imageData, staged);
+            freeImageData(r.imageData);
+            break;
+
+        case Resource::Sound:
+            assert(false);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    r.state = Resource::Ready;
+}
+
+static void removeLoaded(Resource* const r)
+{
+    for(int i = 0; i < loader.loaded.size(); ++i)
+    {
+        if(loader.loaded[i] == r)
+        {
+            loader.loaded[i] = loader.loaded.back();
+            loader.loaded.popBack();
+            return;
+        }
+    }
+
+    assert(false);
+}
+
+static bool isResourceReady(Resource* const r)
+{
+    std::lock_guard<std::mutex> lock(loader.mutex);
+    return r->state == Resource::Ready;
+}
+
+// blocks until r is Ready
+static void waitForResource(Resource* const r)
+{
+    {
+        std::unique_lock<std::mutex> lock(loader.mutex);
+
+        if(r->state == Resource::Ready)
+            return;
+
+        // not picked up by a worker yet, do its job here
+        for(int i = 0; i < loader.queue.size(); ++i)
+        {
+            if(loader.queue[i] == r)
+            {
+                for(int j = i + 1; j < loader.queue.size(); ++j)
+                    loader.queue[j - 1] = loader.queue[j];
+
+                loader.queue.popBack();
+                lock.unlock();
+
+                if(r->state == Resource::Staging)
+                {
+                    copyToStagingBuffer(*r);
+                    r->state = Resource::Staged;
+                }
+                else
+                {
+                    loadResourceData(*r);
+                    r->state = Resource::Loaded;
+                }
+
+                uploadResource(*r);
+                return;
+            }
+        }
+
+        loader.workDone.wait(lock, [r]{return r->state == Resource::Loaded ||
+                                              r->state == Resource::Staged;});
+        removeLoaded(r);
+    }
+
+    uploadResource(*r);
+}
+
+void processResourceUploads(const float budgetMs)
+{
+    PROFILE_SCOPE("processResourceUploads");
+    const double endTime = glfwGetTime() + budgetMs / 1000.0;
+
+    // at least one upload per call
+    do
+    {
+        Resource* r;
+        {
+            std::lock_guard<std::mutex> lock(loader.mutex);
+
+            if(loader.loaded.empty())
+                return;
+
+            r = loader.loaded.back();
+            loader.loaded.popBack();
+        }
+
+        // the copy to the pixel buffer runs on a worker thread, the upload in a later call
+        if(r->state == Resource::Loaded && beginStagedUpload(*r))
+        {
+            std::lock_guard<std::mutex> lock(loader.mutex);
+            r->state = Resource::Staging;
+            loader.queue.pushBack(r);
+            loader.workAdded.notify_one();
+            continue;
+        }
+
+        const long long begin = getTimeNs();
+        uploadResource(*r);
+
+        traceEvent("upload", r->filename, begin, getTimeNs());
+    }
+    while(glfwGetTime() < endTime);
+}
+
+// the jobs that were not picked up stay in the queue, waitForResource() loads them
+static void stopLoaderThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.quit = true;
+        loader.workAdded.notify_all();
+    }
+
+    for(int i = 0; i < loader.numThreads; ++i)
+        loader.threads[i].join();
+
+    loader.numThreads = 0;
+}
+
+static void deleteResource(const int idx)
+{
+    Resource* const r = resources[idx];
+    waitForResource(r);
+
+    switch(r->type)
+    {
+        case Resource::Font:
+            deleteFont(r->font);
+            break;
+
+        case Resource::Texture:
+            deleteTexture(r->texture);
+            break;
+
+        case Resource::Sound:
+            FCHECK( FMOD_Sound_Release(r->sound) );
+            unmapFile(r->soundFile);
+            break;
+    }
+
+    delete r;
+    resources[idx] = resources.back();
+    resources.popBack();
+}
+
+static void releaseResource(const int idx)
+{
+    Resource* const r = resources[idx];
+    assert(r->refCount > 0);
+    --r->refCount;
+
+    if(r->refCount == 0 && !r->keepAlive)
+        deleteResource(idx);
+}
+
+// async - the resource is loaded by the loader threads, otherwise it is Ready on return
+// (acquiring a resource that is still loading waits for it)
+static Resource* acquireResource(const Resource::Type type, const char* const filename,
+                                 const int param0, const int param1, const int param2,
+                                 const bool keepAlive, const bool async)
+{
+    Resource* r = findResource(type, filename, param0, param1, param2);
+
+    if(r)
+    {
+        ++r->refCount;
+        r->keepAlive |= keepAlive;
+
+        if(!async)
+            waitForResource(r);
+
+        return r;
+    }
+
+    r = addResource(type, filename, param0, param1, param2, keepAlive);
+
+    if(async)
+        queueResource(r);
+    else
+    {
+        loadResourceData(*r);
+        r->state = Resource::Loaded;
+        uploadResource(*r);
+    }
+
+    return r;
+}
+
+Font* acquireFont(const char* const filename, const int fontSize, const int textureWidth,
+                  const bool sdf, const bool keepAlive)
+{
+    return &acquireResource(Resource::Font, filename, fontSize, textureWidth, sdf, keepAlive,
+                            false)->font;
+}
+
+Texture* acquireTexture(const char* const filename, const bool keepAlive)
+{
+    return &acquireResource(Resource::Texture, filename, 0, 0, 0, keepAlive, false)->texture;
+}
+
+Font* acquireFontAsync(const char* const filename, const int fontSize, const int textureWidth,
+                       const bool sdf, const bool keepAlive)
+{
+    return &acquireResource(Resource::Font, filename, fontSize, textureWidth, sdf, keepAlive,
+                            true)->font;
+}
+
+Texture* acquireTextureAsync(const char* const filename, const bool keepAlive)
+{
+    return &acquireResource(Resource::Texture, filename, 0, 0, 0, keepAlive, true)->texture;
+}
+
+// fmod has its own loader thread for FMOD_NONBLOCKING, the flag is not a part of the key
+static FMOD_SOUND* acquireSoundResource(const char* const filename, FMOD_MODE mode,
+                                        const bool keepAlive, const bool async)
+{
+    mode &= ~FMOD_NONBLOCKING;
+    Resource* r = findResource(Resource::Sound, filename, mode, 0, 0);
+
+    if(r)
+    {
+        ++r->refCount;
+        r->keepAlive |= keepAlive;
+
+        // opened by acquireSoundAsync(), wait like the other synchronous variants
+        FMOD_OPENSTATE state = FMOD_OPENSTATE_READY;
+
+        if(!async)
+            FCHECK( FMOD_Sound_GetOpenState(r->sound, &state, nullptr, nullptr, nullptr) );
+
+        while(state == FMOD_OPENSTATE_LOADING || state == FMOD_OPENSTATE_CONNECTING)
+        {
+            std::this_thread::yield();
+            FCHECK( FMOD_Sound_GetOpenState(r->sound, &state, nullptr, nullptr, nullptr) );
+        }
+
+        return r->sound;
+    }
+
+    r = addResource(Resource::Sound, filename, mode, 0, 0, keepAlive);
+    r->soundFile = mapFile(filename);
+
+    if(async)
+        mode |= FMOD_NONBLOCKING;
+
+    if(!r->soundFile.data)
+    {
+        FCHECK( FMOD_System_CreateSound(fmodSystem, filename, mode, nullptr, &r->sound) );
+        return r->sound;
+    }
+
+    FMOD_CREATESOUNDEXINFO info;
+    memset(&info, 0, sizeof(info));
+    info.cbsize = sizeof(info);
+    info.length = r->soundFile.size;
+
+    // fmod decodes samples into its own buffer anyway, it can't point into a wav file
+    const FMOD_MODE memoryMode = (mode & FMOD_CREATESAMPLE) ? FMOD_OPENMEMORY :
+                                                              FMOD_OPENMEMORY_POINT;
+
+    FCHECK( FMOD_System_CreateSound(fmodSystem, (const char*)r->soundFile.data,
+                                    mode | memoryMode, &info, &r->sound) );
+    return r->sound;
+}
+
+FMOD_SOUND* acquireSound(const char* const filename, const FMOD_MODE mode, const bool keepAlive)
+{
+    return acquireSoundResource(filename, mode, keepAlive, false);
+}
+
+FMOD_SOUND* acquireSoundAsync(const char* const filename, const FMOD_MODE mode,
+                              const bool keepAlive)
+{
+    return acquireSoundResource(filename, mode, keepAlive, true);
+}
+
+static int findHandle(const Resource::Type type, const void* const handle)
+{
+    for(int i = 0; i < resources.size(); ++i)
+    {
+        const Resource* const r = resources[i];
+
+        if(r->type != type)
+            continue;
+
+        if((type == Resource::Font && &r->font == handle) ||
+           (type == Resource::Texture && &r->texture == handle) ||
+           (type == Resource::Sound && r->sound == handle))
+            return i;
+    }
+
+    assert(false);
+    return -1;
+}
+
+void releaseFont(Font* const font)
+{
+    releaseResource(findHandle(Resource::Font, font));
+}
+
+void releaseTexture(Texture* const texture)
+{
+    releaseResource(findHandle(Resource::Texture, texture));
+}
+
+void releaseSound(FMOD_SOUND* const sound)
+{
+    releaseResource(findHandle(Resource::Sound, sound));
+}
+
+bool isFontReady(Font* const font)
+{
+    return isResourceReady(resources[findHandle(Resource::Font, font)]);
+}
+
+bool isTextureReady(Texture* const texture)
+{
+    return isResourceReady(resources[findHandle(Resource::Texture, texture)]);
+}
+
+bool isSoundReady(FMOD_SOUND* const sound)
+{
+    FMOD_OPENSTATE state;
+    FCHECK( FMOD_Sound_GetOpenState(sound, &state, nullptr, nullptr, nullptr) );
+    return state == FMOD_OPENSTATE_READY;
+}
+
+void deleteUnusedResources()
+{
+    stopLoaderThreads();
+
+    for(int i = resources.size() - 1; i >= 0; --i)
+    {
+        if(resources[i]->refCount == 0)
+            deleteResource(i);
+        else
+            printf("resource still in use: %s (refCount = %d)\n", resources[i]->filename,
+                   resources[i]->refCount);
+    }
+
+    glDeleteBuffers(loader.pbos.size(), loader.pbos.data());
+    loader.pbos.clear();
+}
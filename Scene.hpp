@@ -1,10 +1,14 @@
 #pragma once
 
 #include "Array.hpp"
+#include "FrameArena.hpp"
 #include "math.hpp"
+#include "FontAtlas.hpp"
 #include "fmod/fmod.h"
 
 using GLuint = unsigned int;
+using GLenum = unsigned int;
+struct GLFWwindow;
 
 // use on plain C arrays
 template<typename T, int N>
@@ -19,7 +23,8 @@ struct FragmentMode
     {
         Color = 0,
         Texture = 1,
-        Font = 2
+        Font = 2,
+        FontSdf = 3
     };
 };
 
@@ -29,20 +34,23 @@ struct Texture
     GLuint id;
 };
 
-struct Glyph
-{
-    vec4 texRect;
-    float advance;
-    vec2 offset;
-};
+struct GlyphCache; // GlyphCache.cpp
 
 struct Font
 {
     Texture texture;
-    Glyph glyphs[127];
+    Glyph glyphs[127]; // ascii, baked up front
     float lineSpace;
+    bool sdf;
+    GlyphCache* glyphCache; // other code points, rasterized on the first use
 };
 
+// FragmentMode::Font or FragmentMode::FontSdf
+inline int getFragmentMode(const Font& font)
+{
+    return font.sdf ? FragmentMode::FontSdf : FragmentMode::Font;
+}
+
 // @TODO(matiTechno)
 // add origin for rotation (needed to properly rotate a text)
 struct Rect
@@ -63,6 +71,12 @@ struct Text
     const char* str = "";
 };
 
+struct Camera
+{
+    vec2 pos;
+    vec2 size;
+};
+
 // @ better naming?
 struct GLBuffers
 {
@@ -83,6 +97,7 @@ struct WinEvent
     };
 
     Type type;
+    long long time; // getTimeNs() when glfw delivered it
 
     // glfw values
     union
@@ -113,7 +128,24 @@ struct WinEvent
     };
 };
 
-// call bindeProgram() first
+// GL state cache (GLState.cpp), the binds, the tracked caps and the uniform values are shadowed
+// and the calls that would not change anything are skipped, so the state has to be set through
+// these functions only (ImGui restores what it changes)
+// the shadow is initialized with the defaults of a new context
+void bindVertexArray(GLuint vao);
+// only GL_ARRAY_BUFFER is cached, the other targets pass through
+void bindBuffer(GLenum target, GLuint buffer);
+// GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE and GL_SCISSOR_TEST are cached
+void setEnabled(GLenum cap, bool enabled);
+// forget the deleted names, glGen*() can return them again
+void deleteVertexArrays(int count, const GLuint* vaos);
+void deleteBuffers(int count, const GLuint* buffers);
+// once per frame, issued / skipped calls of the last frame in glStateImgui()
+void glStateFrame();
+void glStateImgui();
+
+// call bindProgram() first
+// the locations and the last values are cached per program
 void uniformMat4(GLuint program, const char* name, const mat4& m);
 void uniform1i(GLuint program, const char* name, int i);
 void uniform1f(GLuint program, const char* name, float f);
@@ -123,6 +155,27 @@ void uniform3f(GLuint program, const char* name, float f1, float f2, float f3);
 void uniform3f(GLuint program, const char* name, vec3 v);
 void uniform4f(GLuint program, const char* name, float f1, float f2, float f3, float f4);
 void uniform4f(GLuint program, const char* name, vec4 v);
+void uniform4fv(GLuint program, const char* name, const vec4* v, int count);
+
+struct MappedFile
+{
+    const unsigned char* data;
+    int size;
+    void* handle; // platform specific
+};
+
+// read only, returns data == nullptr on failure
+// the file is looked up in the asset pack first (a view, no system calls), then in the
+// working directory
+// unmap with unmapFile()
+MappedFile mapFile(const char* filename);
+void unmapFile(MappedFile& file);
+
+// maps filename from the directory of the executable, see AssetPack.hpp
+// returns false if there is no valid pack
+bool openAssetPack(const char* filename);
+// call after all the resources are deleted
+void closeAssetPack();
 
 void bindTexture(const Texture& texture, GLuint unit = 0);
 // delete with deleteTexture()
@@ -130,28 +183,167 @@ Texture createTextureFromFile(const char* filename);
 void deleteTexture(const Texture& texture);
 
 // delete with deleteFont()
-Font createFontFromFile(const char* filename, int fontSize, int textureWidth);
+// loads the atlas baked by fontBaker (see FontAtlas.hpp), if it is missing or stale the font
+// is baked here
+// sdf - render with FragmentMode::FontSdf, crisp at any Text::scale
+Font createFontFromFile(const char* filename, int fontSize, int textureWidth, bool sdf = false);
 void deleteFont(Font& font);
 
+// createTextureFromFile() and createFontFromFile() split in two steps
+// load*Data() does not touch OpenGL and can run on any thread (see acquire*Async())
+// create*FromData() uploads, fromUnpackBuffer - the pixels were copied to offset 0 of the bound
+// GL_PIXEL_UNPACK_BUFFER
+// free with free*Data()
+
+struct ImageData
+{
+    unsigned char* pixels; // RGBA8, nullptr on failure
+    ivec2 size;
+};
+
+// returns false on failure
+bool loadImageData(const char* filename, ImageData& image);
+void freeImageData(ImageData& image);
+Texture createTextureFromData(const ImageData& image, bool fromUnpackBuffer = false);
+
+struct FontData
+{
+    char filename[256];
+    int fontSize;
+    bool sdf;
+    FontAtlas atlas; // bitmap is empty if the atlas file was mapped
+    MappedFile file;
+    const unsigned char* bitmap; // GL_R8, atlas.size, nullptr on failure
+};
+
+// returns false on failure
+bool loadFontData(const char* filename, int fontSize, int textureWidth, bool sdf,
+                  FontData& data);
+void freeFontData(FontData& data);
+Font createFontFromData(const FontData& data, bool fromUnpackBuffer = false);
+
+// shared resources, reference counted and keyed by (filename, creation parameters)
+// acquiring an already loaded resource is free
+// keepAlive - the resource is not deleted when its reference count drops to 0, it survives
+//             scene switches (deleteUnusedResources() deletes it)
+Font* acquireFont(const char* filename, int fontSize, int textureWidth, bool sdf,
+                  bool keepAlive = false);
+Texture* acquireTexture(const char* filename, bool keepAlive = false);
+FMOD_SOUND* acquireSound(const char* filename, FMOD_MODE mode, bool keepAlive = false);
+void releaseFont(Font* font);
+void releaseTexture(Texture* texture);
+void releaseSound(FMOD_SOUND* sound);
+
+// async variants, return immediately, use the resource after is*Ready() returns true
+// fonts and textures are decoded on the loader threads and uploaded by
+// processResourceUploads(), sounds are opened with FMOD_NONBLOCKING
+// acquiring with the synchronous variant waits for the load, acquiring a next scene's
+// resources ahead of time (and releasing them later) is a prefetch
+Font* acquireFontAsync(const char* filename, int fontSize, int textureWidth, bool sdf,
+                       bool keepAlive = false);
+Texture* acquireTextureAsync(const char* filename, bool keepAlive = false);
+FMOD_SOUND* acquireSoundAsync(const char* filename, FMOD_MODE mode, bool keepAlive = false);
+bool isFontReady(Font* font);
+bool isTextureReady(Texture* texture);
+bool isSoundReady(FMOD_SOUND* sound);
+// call once per frame, until budgetMs is spent (at least one resource): maps a pixel buffer
+// object for each resource the loader threads have decoded (a loader thread copies the pixels
+// into it) and uploads the ones copied since the last call
+void processResourceUploads(float budgetMs);
+// call at exit
+void deleteUnusedResources();
+
+// call once after the context is created
+// linked programs are cached in shadercache/ next to the executable, keyed by the sources and
+// the driver (vendor, renderer, version), see createProgram()
+void initProgramCache();
+// issues the compile and link without waiting for them (in parallel with
+// KHR_parallel_shader_compile), a later createProgram() with the same sources takes the result
+void prefetchProgram(const char* vertexSrc, const char* fragmentSrc);
 // returns 0 on failure
 // program must be deleted with deleteProgram() (if != 0)
+// loads the cached binary if there is a valid one, otherwise compiles and stores the binary
 GLuint createProgram(const char* vertexSrc, const char* fragmentSrc);
 void deleteProgram(GLuint program);
+// deletes the prefetched programs that createProgram() never took, call at exit
+void deleteUnusedPrograms();
 void bindProgram(const GLuint program);
 
 // delete with deleteGLBuffers()
 GLBuffers createGLBuffers();
-// @TODO(matiTechno): we might want updateSubGLBuffers()
 void updateGLBuffers(GLBuffers& glBuffers, const Rect* rects, int count);
+// updates rects [first, first + count) in place, the storage must already be allocated
+// with updateGLBuffers()
+void updateSubGLBuffers(GLBuffers& glBuffers, const Rect* rects, int first, int count);
 // call bindProgram() first
-void renderGLBuffers(GLBuffers& glBuffers, int numRects);
+void renderGLBuffers(const GLBuffers& glBuffers, int numRects);
 void deleteGLBuffers(GLBuffers& glBuffers);
 
+// Text::str is UTF-8
+// ascii comes from Font::glyphs, other code points are rasterized into the glyph cache pages
+// of the font texture on the first use (uploads only the glyph rectangle, binds font.texture)
+// glyphs missing in the font are rendered as '?'
+const Glyph& getGlyph(const Font& font, int codepoint);
+// changes when glyphs are evicted from the cache, their texture rectangles are reused
+// text laid out before the change has to be laid out again
+int getGlyphCacheGeneration(const Font& font);
+// call once per frame, the glyph cache does not evict pages used in the current frame
+void glyphCacheFrame();
+// returns the code point and advances str, invalid sequences decode as U+FFFD
+int decodeUtf8(const char*& str);
+
 // returns the number of rects written
 int writeTextToBuffer(const Text& text, const Font& font, Rect* buffer, int maxSize);
 // bbox
 vec2 getTextSize(const Text& text, const Font& font);
 
+struct TextLayout
+{
+    int numRects;
+    vec2 size; // bbox
+};
+
+// writeTextToBuffer() and getTextSize() in one pass
+TextLayout layoutText(const Text& text, const Font& font, Rect* buffer, int maxSize);
+
+// laid out once and uploaded, rects are relative to the pen position (Text::pos is ignored)
+struct TextMesh
+{
+    GLBuffers glBuffers;
+    int numRects;
+    vec2 size; // bbox
+};
+
+// retained text meshes keyed by (string, font, scale, color, glyph cache generation)
+// when all entries are taken the least recently used one is replaced
+struct TextCache
+{
+    struct Entry
+    {
+        unsigned long long key = 0; // hash of the fields below, 0 - free
+        // compared on a hash match, a collision must not draw another string
+        Array<char> str; // with the terminator
+        GLuint fontTexture;
+        float scale;
+        vec4 color;
+        int generation;
+        int lastUse;
+        TextMesh mesh;
+    };
+
+    Entry entries[32];
+    int useCounter = 0;
+};
+
+// glBuffers of the entries are created on demand, delete with deleteTextCache()
+void deleteTextCache(TextCache& cache);
+// lays out and uploads the text only if it is not in the cache
+// returned reference is valid until the next getTextMesh() call
+const TextMesh& getTextMesh(TextCache& cache, const Text& text, const Font& font);
+// call bindProgram() and bindTexture(font.texture) first
+// camera - the one set in cameraPos / cameraSize uniforms, it is restored after the draw
+void renderTextMesh(GLuint program, const TextMesh& mesh, vec2 pos, const Camera& camera);
+
 bool fmodCheck(FMOD_RESULT r, const char* file, int line); // don't use this
 
 // wrap fmod calls in this
@@ -160,12 +352,8 @@ bool fmodCheck(FMOD_RESULT r, const char* file, int line); // don't use this
 
 extern FMOD_SYSTEM* fmodSystem;
 extern GLFWwindow* gGlfwWindow;
-
-struct Camera
-{
-    vec2 pos;
-    vec2 size;
-};
+// GameScene logic on its own thread, false - ticked in GameScene::update() with the frame time
+extern bool gSimulationThread;
 
 Camera expandToMatchAspectRatio(Camera camera, vec2 viewportSize);
 
@@ -173,6 +361,126 @@ Camera expandToMatchAspectRatio(Camera camera, vec2 viewportSize);
 float getRandomFloat(float min, float max);
 int getRandomInt(int min, int max);
 
+// monotonic, nanoseconds
+long long getTimeNs();
+
+// game logs (Replay.cpp), the seed passed to srand() and per frame the frame time, the poll time
+// and the events after the ImGui filtering; raw WinEvents, replay on the platform it was
+// recorded on
+bool startRecording(const char* filename, unsigned seed);
+void recordFrame(float dt, long long timeNs, const Array<WinEvent>& events);
+void stopRecording();
+bool startReplay(const char* filename, unsigned& seed);
+// returns false at the end of the log
+bool replayFrame(float& dt, long long& timeNs, Array<WinEvent>& events);
+void stopReplay();
+// recording or replaying, settings that change the game (not logged) must stay fixed
+bool isGameLogActive();
+
+// offscreen capture to a Y4M video (Capture.cpp)
+// the scene is rendered into a framebuffer of the given size, frames are read back through a
+// ring of pixel buffer objects (the render thread does not wait on glReadPixels()) and
+// converted / written on a worker thread
+// size must be even, returns false on failure
+bool startCapture(const char* filename, ivec2 size, int fps);
+bool isCapturing();
+ivec2 getCaptureSize();
+// binds the capture framebuffer and clears it
+void beginCaptureFrame();
+// numCopies - how many video frames this frame covers (0 - it is dropped)
+// queues the readback and blits the frame to the window
+void endCaptureFrame(int numCopies, ivec2 windowSize);
+// writes the frames still in flight
+void stopCapture();
+
+// input latency (Latency.cpp), a sample per frame with input: from the oldest event of the frame
+// through the stages of the main loop to a fence after the swap (the scanout is not included)
+// stages are the time since the previous one, histograms with p50 / p95 / p99 in ImGui, all
+// samples in a CSV
+// when the scene applies the input later (GameScene, on the simulation thread) the sample ends in
+// the first frame that renders it (Scene::frame_.numInputRendered), the render stage includes the
+// frames in between
+struct LatencyStage
+{
+    enum
+    {
+        Poll, // from the GLFW callback
+        ProcessInput,
+        Update,
+        Render,
+        Swap,
+        Gpu,
+        EndToEnd,
+        Count
+    };
+};
+
+bool startLatencyMeasurement(const char* csvFilename);
+void stopLatencyMeasurement();
+bool isMeasuringLatency();
+// between beginLatencySample() and the frame that ends it
+bool isInLatencySample();
+void resetLatencyHistograms();
+// inputTime - getTimeNs() of the event, does nothing when not measuring
+void beginLatencySample(long long inputTime);
+void markLatencyStage(int stage);
+// call after processInput(), the sample waits for this many events to be rendered
+void setLatencyInputTarget(unsigned numInputTaken);
+// call after the Gpu stage, does nothing until the input of the sample is rendered
+void endLatencySample(unsigned numInputRendered);
+void latencyImgui();
+
+// gpu time of the render passes (GpuTimer.cpp), GL_TIME_ELAPSED queries in a ring of 3 frames,
+// the results are read when they are done and never wait for the gpu
+struct GpuPass
+{
+    enum
+    {
+        Board,
+        Pieces,
+        Qubes,
+        Lines,
+        Text,
+        ImGui,
+        Count
+    };
+};
+
+void initGpuTimers();
+void deleteGpuTimers();
+// passes can't nest
+void beginGpuPass(int pass);
+void endGpuPass();
+// main thread, once per frame after the swap
+void gpuTimersFrame();
+// averages of the last 30 frames
+void gpuTimersImgui();
+
+// Chrome trace recording (Trace.cpp), open in chrome://tracing or ui.perfetto.dev
+// every frame, the profiler zones of all threads (Profiler.hpp, when compiled in), scene changes,
+// resource loads and the gpu time of the frames (GL_TIMESTAMP queries)
+// every thread pushes its events into its own buffer without locks, a worker thread formats and
+// writes them
+// seconds - stops by itself after that, 0 - at stopTrace()
+bool startTrace(const char* filename, float seconds);
+bool isTracing();
+// main thread, the frame is from the begin to the end call (the swap included)
+void traceBeginFrame();
+void traceEndFrame();
+void stopTrace();
+// any thread, nothing happens when not tracing
+// name - static storage (a string literal), only the pointer is stored
+void traceEvent(const char* name, long long begin, long long end); // getTimeNs()
+// detail is copied (up to 31 characters), shown after the name
+void traceEvent(const char* name, const char* detail, long long begin, long long end);
+void traceInstant(const char* name);
+// an event of another thread, see getTraceThreadId()
+void traceThreadEvent(int thread, const char* name, long long begin, long long end);
+// of the calling thread, assigned on the first call
+int getTraceThreadId();
+// shown in the traces and in the profiler
+void setThreadName(const char* name);
+
 class Scene
 {
 public:
@@ -185,10 +493,21 @@ public:
     {
         // these are set in the main loop before processInput() call
         float time;  // seconds
+        long long timeNs; // getTimeNs() after the event poll, the events are older
         vec2 fbSize; // fb = framebuffer
+        // for the data that lives until the end of the frame, reset after the swap
+        FrameArena* arena;
 
         // @TODO(matiTechno): bool updateWhenNotTop = false;
         bool popMe = false;
+        // counters of the scenes that apply the input later (processInput() increments the first,
+        // render() sets the second to the number of those events the rendered state includes),
+        // the other scenes render the input of the frame and leave both at 0
+        unsigned numInputTaken = 0;
+        unsigned numInputRendered = 0;
+        // set by the scene every frame, seconds until it changes without input (timers)
+        // in idle mode the main loop sleeps until an event or this time, 0 - redraw every frame
+        float nextChange = 0.f;
         Scene* newScene = nullptr; // assigned ptr must be returned by new
                                    // game loop will call delete on it
     } frame_;
@@ -269,24 +588,45 @@ struct Tetrimino
 	ivec2 pos;
 	int rotation;
 	int type;
-	vec4 color;
+	int tileColor;
 	Box box;
 	int boxSide;
 };
 
+// indices into tilePalette (GameScene.cpp)
+struct TileColor
+{
+	enum
+	{
+		Free,
+		I,
+		O,
+		T,
+		S,
+		Z,
+		J,
+		L,
+		Shadow, // 3d only
+		Count
+	};
+};
 
 struct Map
 {
-	ivec2 size = ivec2(10, 20);
-	Rect rects[10 * 20]; // meeh
-	const vec4 baseColor = vec4(0.3f, 0.f, 0.5f, 1.f);
+	ivec2 size;
+	Array<unsigned char> tiles; // TileColor, size.x * size.y
 };
 
+// all tiles are free
+void initMap(Map& map, ivec2 size);
+
 class GameScene: public Scene
 {
 public:
     GameScene();
     ~GameScene() override;
+    // see prefetchProgram()
+    static void prefetchPrograms();
     void processInput(const Array<WinEvent>& events) override;
     void update() override;
     void render(GLuint program) override;
@@ -294,13 +634,23 @@ public:
 private:
 	Camera3d camera_;
 	GLBuffers glBuffers_;
-	Font font_;
+	GLBuffers boardBuffers_; // boardRects_, only dirty rows are re-uploaded
+	Font* font_;
+	TextCache textCache_;
 
-	Map map_;
-	Tetrimino tetrimino_, tetNext_;
-    bool executeStep_ = false;
-    bool gameOver_ = false;
-    int score_ = 0.f;
+	struct
+	{
+		int score = -1;
+		char str[32];
+	} scoreText_; // formatted only when score_ changes
+
+	Map map_; // tiles of the last snapshot
+	Array<Rect> boardRects_; // map_ as rects, colors are refreshed from tiles when a row is uploaded
+	// set by update() when a snapshot changes map_, the simulation does not track them
+	Array<bool> boardDirtyRows_; // not yet uploaded to boardBuffers_ / boardTexture_
+	bool boardMeshDirty_ = true; // buildBoardMesh() has to be called
+	struct GameSimulation* sim_; // GameScene.cpp
+	int numInputDropped_ = 0; // the simulation's input ring was full
 
 	GLuint p3d_;
 	GLuint vboQube_;
@@ -310,7 +660,27 @@ private:
 	GLuint vao_;
 	GLuint programLines_;
 
+	// greedy meshed locked tiles, rebuilt only when the map changes
+	GLuint pBoard3d_;
+	GLuint vaoBoard_;
+	GLuint vboBoard_;
+	GLuint iboBoard_;
+	int boardNumVertices_ = 0;
+	int boardNumIndices_ = 0;
+
+	void buildBoardMesh(FrameArena& arena);
+	void uploadDirtyRows();
+
+	// map_.tiles as a GL_R8UI texture, the board is drawn with one instanced draw call
+	// of map_.size.x * map_.size.y quads / qubes that fetch their tile by gl_InstanceID
+	Texture boardTexture_;
+	GLuint pBoardTex2d_;
+	GLuint pBoardTex3d_;
+	GLuint vaoBoardTex_;
+	bool boardFromTexture_ = true;
+
 	bool render3d_ = true;
+	bool benchQubes_ = false; // draw additional 1000 qubes
 
 	bool enableCameraInput_ = false;
 };
@@ -0,0 +1,408 @@
+// see SoftRaster.hpp
+#include "SoftRaster.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFT_RASTER_SSE2
+#include <emmintrin.h>
+#endif
+
+static const int softTileSize = 64;
+
+// per rect, computed once per softRenderRects() call
+struct SoftRect
+{
+    ivec2 min; // pixel bbox, max exclusive
+    ivec2 max;
+    // local quad coordinates in [-0.5, 0.5) as a function of the pixel center
+    // a = a0 + px * ax + py * ay (see vertexSrc)
+    vec2 a0;
+    vec2 ax;
+    vec2 ay;
+    unsigned int color; // packed rect.color
+    float sdfWidth; // fwidth() of the distance in FragmentMode::FontSdf
+};
+
+void resizeSoftFramebuffer(SoftFramebuffer& fb, const ivec2 size)
+{
+    fb.size = size;
+    fb.pixels.resize(size.x * size.y);
+}
+
+static unsigned char toByte(const float v)
+{
+    return v <= 0.f ? 0 : v >= 1.f ? 255 : (unsigned char)(v * 255.f + 0.5f);
+}
+
+static unsigned int packColor(const vec4 color)
+{
+    return toByte(color.x) | (toByte(color.y) << 8) | (toByte(color.z) << 16) |
+           ((unsigned int)toByte(color.w) << 24);
+}
+
+void clearSoftFramebuffer(SoftFramebuffer& fb, const vec4 color)
+{
+    const unsigned int c = packColor(color);
+
+    for(unsigned int& pixel: fb.pixels)
+        pixel = c;
+}
+
+// x / 255 rounded, x <= 255 * 255
+static inline unsigned int div255(const unsigned int x)
+{
+    return (x + 128 + ((x + 128) >> 8)) >> 8;
+}
+
+static inline void blendPixel(unsigned int& dst, const unsigned int src)
+{
+    const unsigned int a = src >> 24;
+    const unsigned int invA = 255 - a;
+    unsigned int out = 0;
+
+    for(int shift = 0; shift < 32; shift += 8)
+    {
+        const unsigned int s = (src >> shift) & 0xFF;
+        const unsigned int d = (dst >> shift) & 0xFF;
+        out |= div255(s * a + d * invA) << shift;
+    }
+
+    dst = out;
+}
+
+// the same color over the whole span
+static void blendSpan(unsigned int* dst, int count, const unsigned int src)
+{
+    const unsigned int a = src >> 24;
+
+    if(a == 0)
+        return;
+
+    if(a == 255)
+    {
+        for(int i = 0; i < count; ++i)
+            dst[i] = src;
+
+        return;
+    }
+
+#ifdef SOFT_RASTER_SSE2
+    // unsigned 16 bit lanes, s * a + d * (255 - a) + 128 <= 255 * 255 + 128 does not overflow
+    // (the terms do not fit in a signed short once a >= 182)
+    const unsigned short r = (src & 0xFF) * a;
+    const unsigned short g = ((src >> 8) & 0xFF) * a;
+    const unsigned short b = ((src >> 16) & 0xFF) * a;
+    const unsigned short aa = a * a;
+    const __m128i srcTerm = _mm_set_epi16((short)aa, (short)b, (short)g, (short)r, (short)aa,
+                                          (short)b, (short)g, (short)r);
+    const __m128i invA = _mm_set1_epi16(255 - a);
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i zero = _mm_setzero_si128();
+
+    for(; count >= 4; count -= 4, dst += 4)
+    {
+        const __m128i d = _mm_loadu_si128((const __m128i*)dst);
+        __m128i lo = _mm_unpacklo_epi8(d, zero);
+        __m128i hi = _mm_unpackhi_epi8(d, zero);
+        lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, invA), srcTerm), bias);
+        hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, invA), srcTerm), bias);
+        // div255()
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for(int i = 0; i < count; ++i)
+        blendPixel(dst[i], src);
+}
+
+// GL_REPEAT (the default wrap mode)
+static inline int wrap(const int i, const int size)
+{
+    const int r = i % size;
+    return r < 0 ? r + size : r;
+}
+
+static vec4 sampleTexture(const SoftTexture& tex, const vec2 uv)
+{
+    const int n = tex.numChannels;
+
+    if(!tex.linear)
+    {
+        const int x = wrap(int(floorf(uv.x * tex.size.x)), tex.size.x);
+        const int y = wrap(int(floorf(uv.y * tex.size.y)), tex.size.y);
+        const unsigned char* const p = tex.pixels + (y * tex.size.x + x) * n;
+
+        if(n == 1)
+            return {p[0] / 255.f, 0.f, 0.f, 1.f};
+
+        return {p[0] / 255.f, p[1] / 255.f, p[2] / 255.f, p[3] / 255.f};
+    }
+
+    const float fx = uv.x * tex.size.x - 0.5f;
+    const float fy = uv.y * tex.size.y - 0.5f;
+    const int x0 = int(floorf(fx));
+    const int y0 = int(floorf(fy));
+    const float tx = fx - x0;
+    const float ty = fy - y0;
+    vec4 result = {0.f, 0.f, 0.f, n == 1 ? 1.f : 0.f};
+
+    for(int j = 0; j < 2; ++j)
+    {
+        for(int i = 0; i < 2; ++i)
+        {
+            const float w = (i ? tx : 1.f - tx) * (j ? ty : 1.f - ty);
+            const int x = wrap(x0 + i, tex.size.x);
+            const int y = wrap(y0 + j, tex.size.y);
+            const unsigned char* const p = tex.pixels + (y * tex.size.x + x) * n;
+
+            for(int c = 0; c < n; ++c)
+                result[c] += w * p[c] / 255.f;
+        }
+    }
+
+    return result;
+}
+
+static float smoothstep(const float edge0, const float edge1, const float x)
+{
+    const float t = min(1.f, max(0.f, (x - edge0) / (edge1 - edge0)));
+    return t * t * (3.f - 2.f * t);
+}
+
+// narrows [tMin, tMax) to the t for which base + t * slope is in [-0.5, 0.5)
+static void clipSpan(const float base, const float slope, float& tMin, float& tMax)
+{
+    if(slope == 0.f)
+    {
+        if(base < -0.5f || base >= 0.5f)
+            tMax = tMin;
+
+        return;
+    }
+
+    float t0 = (-0.5f - base) / slope;
+    float t1 = (0.5f - base) / slope;
+
+    if(slope < 0.f)
+    {
+        const float temp = t0;
+        t0 = t1;
+        t1 = temp;
+    }
+
+    tMin = max(tMin, t0);
+    tMax = min(tMax, t1);
+}
+
+static bool setupRect(const Rect& rect, const SoftRenderState& state, const ivec2 fbSize,
+                      SoftRect& soft)
+{
+    if(rect.size.x == 0.f || rect.size.y == 0.f)
+        return false;
+
+    const Camera& camera = state.camera;
+    const vec2 pixelScale = vec2(fbSize.x, fbSize.y) / camera.size;
+    const float s = sinf(rect.rotation);
+    const float c = cosf(rect.rotation);
+
+    // corners, see vertexSrc
+    vec2 bboxMin = {1e30f, 1e30f};
+    vec2 bboxMax = {-1e30f, -1e30f};
+
+    for(int i = 0; i < 4; ++i)
+    {
+        const vec2 a = {i == 1 || i == 2 ? 0.5f : -0.5f, i >= 2 ? 0.5f : -0.5f};
+        const vec2 rotated = {a.x * c - a.y * s, -(a.x * s + a.y * c)};
+        const vec2 world = (rotated + vec2(0.5f)) * rect.size + rect.pos;
+        const vec2 pixel = (world - camera.pos) * pixelScale;
+        bboxMin = {min(bboxMin.x, pixel.x), min(bboxMin.y, pixel.y)};
+        bboxMax = {max(bboxMax.x, pixel.x), max(bboxMax.y, pixel.y)};
+    }
+
+    // pixel centers inside
+    soft.min.x = max(0, int(ceilf(bboxMin.x - 0.5f)));
+    soft.min.y = max(0, int(ceilf(bboxMin.y - 0.5f)));
+    soft.max.x = min(fbSize.x, int(ceilf(bboxMax.x - 0.5f)));
+    soft.max.y = min(fbSize.y, int(ceilf(bboxMax.y - 0.5f)));
+
+    if(soft.min.x >= soft.max.x || soft.min.y >= soft.max.y)
+        return false;
+
+    // inverse of vertexSrc
+    // q = (world - pos) / size - 0.5, r = (q.x, -q.y), a = rotate(r, -rotation)
+    const vec2 dq = vec2(1.f) / (pixelScale * rect.size);
+    const vec2 q0 = (camera.pos - rect.pos) / rect.size - vec2(0.5f);
+    soft.a0 = {q0.x * c - q0.y * s, -q0.x * s - q0.y * c};
+    soft.ax = {dq.x * c, -dq.x * s};
+    soft.ay = {-dq.y * s, -dq.y * c};
+
+    soft.color = packColor(rect.color);
+    soft.sdfWidth = 0.f;
+
+    if(state.mode == FragmentMode::FontSdf && state.texture)
+    {
+        // the distance changes by sdfPixelDistScale / 255 per texel
+        const float texels = rect.texRect.z * state.texture->size.x;
+        const float pixels = rect.size.x * pixelScale.x;
+        soft.sdfWidth = sdfPixelDistScale / 255.f * texels / pixels;
+    }
+
+    return true;
+}
+
+static void renderRect(SoftFramebuffer& fb, const SoftRenderState& state, const Rect& rect,
+                       const SoftRect& soft, const ivec2 tileMin, const ivec2 tileMax)
+{
+    const ivec2 from = {max(soft.min.x, tileMin.x), max(soft.min.y, tileMin.y)};
+    const ivec2 to = {min(soft.max.x, tileMax.x), min(soft.max.y, tileMax.y)};
+
+    if(from.x >= to.x || from.y >= to.y)
+        return;
+
+    const SoftTexture* const tex = state.mode == FragmentMode::Color ? nullptr : state.texture;
+
+    for(int y = from.y; y < to.y; ++y)
+    {
+        unsigned int* const row = fb.pixels.data() + y * fb.size.x;
+        const vec2 rowStart = soft.a0 + soft.ax * (from.x + 0.5f) + soft.ay * (y + 0.5f);
+
+        // the quad covers a single span of the row (convex)
+        float tMin = 0.f;
+        float tMax = to.x - from.x;
+        clipSpan(rowStart.x, soft.ax.x, tMin, tMax);
+        clipSpan(rowStart.y, soft.ax.y, tMin, tMax);
+
+        if(tMin >= tMax)
+            continue;
+
+        const int start = from.x + int(ceilf(tMin));
+        const int end = from.x + int(ceilf(tMax));
+
+        if(!tex)
+        {
+            blendSpan(row + start, end - start, soft.color);
+            continue;
+        }
+
+        vec2 a = rowStart + soft.ax * float(start - from.x);
+
+        for(int x = start; x < end; ++x, a += soft.ax)
+        {
+            const vec2 uv = {(a.x + 0.5f) * rect.texRect.z + rect.texRect.x,
+                             (0.5f - a.y) * rect.texRect.w + rect.texRect.y};
+
+            const vec4 texColor = sampleTexture(*tex, uv);
+            vec4 color = rect.color;
+
+            if(state.mode == FragmentMode::Texture)
+                color *= texColor;
+            else if(state.mode == FragmentMode::Font)
+                color *= texColor.x;
+            else
+                color *= smoothstep(0.5f - soft.sdfWidth, 0.5f + soft.sdfWidth, texColor.x);
+
+            blendPixel(row[x], packColor(color));
+        }
+    }
+}
+
+void softRenderRects(SoftFramebuffer& fb, const SoftRenderState& state, const Rect* const rects,
+                     const int count, int numThreads)
+{
+    Array<SoftRect> softRects;
+    Array<int> indices; // of the visible rects
+    softRects.resize(count);
+    indices.reserve(count);
+
+    for(int i = 0; i < count; ++i)
+    {
+        if(setupRect(rects[i], state, fb.size, softRects[i]))
+            indices.pushBack(i);
+    }
+
+    const ivec2 numTiles = (fb.size + ivec2(softTileSize - 1)) / softTileSize;
+    const int totalTiles = numTiles.x * numTiles.y;
+    std::atomic<int> nextTile(0);
+
+    // each tile is owned by one thread, the rects are blended in order
+    auto work = [&]()
+    {
+        while(true)
+        {
+            const int tile = nextTile++;
+
+            if(tile >= totalTiles)
+                return;
+
+            const ivec2 tileMin = ivec2(tile % numTiles.x, tile / numTiles.x) * softTileSize;
+            const ivec2 tileMax = {min(tileMin.x + softTileSize, fb.size.x),
+                                   min(tileMin.y + softTileSize, fb.size.y)};
+
+            for(const int i: indices)
+                renderRect(fb, state, rects[i], softRects[i], tileMin, tileMax);
+        }
+    };
+
+    if(numThreads <= 0)
+        numThreads = max(1, int(std::thread::hardware_concurrency()));
+
+    numThreads = min(numThreads, max(1, totalTiles));
+
+    Array<std::thread*> threads;
+
+    for(int i = 1; i < numThreads; ++i)
+        threads.pushBack(new std::thread(work));
+
+    work();
+
+    for(std::thread* thread: threads)
+    {
+        thread->join();
+        delete thread;
+    }
+}
+
+bool writeSoftFramebuffer(const char* const filename, const SoftFramebuffer& fb)
+{
+    FILE* const fp = fopen(filename, "wb");
+
+    if(!fp)
+    {
+        printf("writeSoftFramebuffer() could not open file: %s\n", filename);
+        return false;
+    }
+
+    unsigned char header[18] = {};
+    header[2] = 2; // uncompressed true color
+    header[12] = fb.size.x & 0xFF;
+    header[13] = fb.size.x >> 8;
+    header[14] = fb.size.y & 0xFF;
+    header[15] = fb.size.y >> 8;
+    header[16] = 32;
+    header[17] = 0x28; // 8 alpha bits, top-left origin
+
+    // BGRA
+    Array<unsigned char> data;
+    data.resize(fb.pixels.size() * 4);
+
+    for(int i = 0; i < fb.pixels.size(); ++i)
+    {
+        const unsigned int p = fb.pixels[i];
+        data[i * 4 + 0] = (p >> 16) & 0xFF;
+        data[i * 4 + 1] = (p >> 8) & 0xFF;
+        data[i * 4 + 2] = p & 0xFF;
+        data[i * 4 + 3] = p >> 24;
+    }
+
+    const bool ok = fwrite(header, sizeof(header), 1, fp) == 1 &&
+                    fwrite(data.data(), 1, data.size(), fp) == size_t(data.size());
+
+    fclose(fp);
+    return ok;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Scene.hpp"
+
+// CPU rasterizer for Rect batches, no OpenGL (headless rendering, golden images, thumbnails)
+// matches the 2D program of main.cpp (vertexSrc, fragmentSrc) with
+// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)
+// the framebuffer is split into tiles rendered in parallel, solid color spans are blended with
+// SSE2
+
+struct SoftTexture
+{
+    ivec2 size;
+    int numChannels; // 4 - RGBA8 (FragmentMode::Texture), 1 - R8 (FragmentMode::Font*)
+    const unsigned char* pixels;
+    bool linear; // bilinear filtering (fonts), nearest otherwise (createTextureFromFile())
+};
+
+// RGBA8, row 0 is the top row (glReadPixels() rows are bottom up)
+struct SoftFramebuffer
+{
+    ivec2 size = {0, 0};
+    Array<unsigned int> pixels;
+};
+
+void resizeSoftFramebuffer(SoftFramebuffer& fb, ivec2 size);
+void clearSoftFramebuffer(SoftFramebuffer& fb, vec4 color);
+
+// the uniforms and the bound texture of the 2D program
+struct SoftRenderState
+{
+    Camera camera;
+    int mode = FragmentMode::Color;
+    const SoftTexture* texture = nullptr;
+};
+
+// numThreads - 0 uses all hardware threads
+void softRenderRects(SoftFramebuffer& fb, const SoftRenderState& state, const Rect* rects,
+                     int count, int numThreads = 0);
+
+// uncompressed 32 bit tga, returns false on failure
+bool writeSoftFramebuffer(const char* filename, const SoftFramebuffer& fb);
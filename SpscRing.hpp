@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+
+// lock-free FIFO for exactly one producer thread and one consumer thread
+// N must be a power of 2, push() fails when N values are unread
+template<typename T, int N>
+class SpscRing
+{
+public:
+	static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+	// producer
+	bool push(const T& val)
+	{
+		const unsigned head = head_.load(std::memory_order_relaxed);
+
+		if (head - tail_.load(std::memory_order_acquire) == N)
+			return false;
+
+		buffer_[head & (N - 1)] = val;
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer, returns nullptr if empty, the value is valid until pop()
+	const T* peek() const
+	{
+		const unsigned tail = tail_.load(std::memory_order_relaxed);
+
+		if (tail == head_.load(std::memory_order_acquire))
+			return nullptr;
+
+		return &buffer_[tail & (N - 1)];
+	}
+
+	// consumer, call only after a successful peek()
+	void pop() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+	T buffer_[N];
+	std::atomic<unsigned> head_{0};
+	// separate cache lines, the threads do not invalidate each other's index
+	// (no alignas, it needs the C++17 aligned new for heap objects)
+	char padding_[64];
+	std::atomic<unsigned> tail_{0};
+};
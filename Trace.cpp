@@ -0,0 +1,420 @@
+// Chrome trace recording, see Scene.hpp
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+static const int traceMaxThreads = 64; // with names and event buffers, the others are not traced
+static const int traceGpuThread = 1000; // the lane of the gpu timestamps
+static const int traceGpuRingSize = 4; // frames in flight
+static const int traceBufferSize = 1 << 13; // events per thread, the writer drains them often
+static const int traceWriterSleepMs = 5;
+
+// names are formatted by the writer thread: name, name detail or name arg
+struct TraceEvent
+{
+    const char* name; // static storage, only the pointer is stored
+    char detail[32]; // copied, usually empty
+    int arg; // -1 - none
+    int thread;
+    char phase; // 'X' - complete, 'i' - instant
+    long long begin; // getTimeNs()
+    long long end;
+};
+
+// single producer (the thread it belongs to) single consumer (the writer thread) ring
+struct TraceBuffer
+{
+    TraceEvent events[traceBufferSize];
+    std::atomic<unsigned> numPushed{0};
+    std::atomic<unsigned> numPopped{0};
+    std::atomic<int> numDropped{0}; // the ring was full
+};
+
+static struct
+{
+    bool active = false; // main thread
+    long long stopTime; // 0 - until stopTrace()
+    FILE* file;
+
+    // startTime is written before recording is set, events that begin before it are skipped
+    std::atomic<bool> recording{false};
+    long long startTime;
+
+    std::mutex mutex; // buffer registration, thread names, quit
+    TraceBuffer* buffers[traceMaxThreads];
+    std::atomic<int> numBuffers{0};
+    char threadNames[traceMaxThreads][32] = {};
+
+    // writer thread
+    std::thread writer;
+    std::condition_variable quitSet;
+    bool quit;
+    int numWritten;
+
+    // frames, main thread
+    long long frameBegin;
+    int numFrames;
+    // GL_TIMESTAMP pairs (begin, end of the frame), results are read when available, a frame is
+    // not measured when the ring is full (the gpu is that far behind, waiting would distort it)
+    GLuint queries[traceGpuRingSize][2];
+    int gpuHead; // next
+    int gpuCount;
+    bool gpuFrame; // queries issued for the current frame
+    long long gpuOffset; // getTimeNs() - GL_TIMESTAMP
+} trace;
+
+static std::atomic<int> traceNumThreads{0};
+static thread_local int traceThreadId = -1;
+static thread_local TraceBuffer* traceBuffer = nullptr;
+
+int getTraceThreadId()
+{
+    if(traceThreadId == -1)
+        traceThreadId = traceNumThreads.fetch_add(1, std::memory_order_relaxed);
+
+    return traceThreadId;
+}
+
+void setThreadName(const char* const name)
+{
+#ifdef PROFILER
+    setProfileThreadName(name);
+#endif
+
+    const int thread = getTraceThreadId();
+
+    if(thread >= traceMaxThreads)
+        return;
+
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    snprintf(trace.threadNames[thread], sizeof(trace.threadNames[thread]), "%s", name);
+}
+
+// of the calling thread, allocated on its first event (the only lock), nullptr if there are too
+// many threads
+static TraceBuffer* getTraceBuffer()
+{
+    if(traceBuffer)
+        return traceBuffer;
+
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    const int numBuffers = trace.numBuffers.load(std::memory_order_relaxed);
+
+    if(numBuffers == traceMaxThreads)
+        return nullptr;
+
+    traceBuffer = new TraceBuffer;
+    trace.buffers[numBuffers] = traceBuffer;
+    trace.numBuffers.store(numBuffers + 1, std::memory_order_release);
+    return traceBuffer;
+}
+
+// no locks and no formatting, the writer thread does that
+static void pushTraceEvent(const char phase, const int thread, const char* const name,
+                           const char* const detail, const int arg, const long long begin,
+                           const long long end)
+{
+    if(!trace.recording.load(std::memory_order_acquire))
+        return;
+
+    TraceBuffer* const buffer = getTraceBuffer();
+
+    if(!buffer)
+        return;
+
+    const unsigned idx = buffer->numPushed.load(std::memory_order_relaxed);
+
+    if(idx - buffer->numPopped.load(std::memory_order_acquire) == unsigned(traceBufferSize))
+    {
+        buffer->numDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    TraceEvent& e = buffer->events[idx & (traceBufferSize - 1)];
+    e.name = name;
+    e.detail[0] = '\0';
+
+    if(detail)
+    {
+        strncpy(e.detail, detail, sizeof(e.detail) - 1);
+        e.detail[sizeof(e.detail) - 1] = '\0';
+    }
+
+    e.arg = arg;
+    e.thread = thread;
+    e.phase = phase;
+    e.begin = begin;
+    e.end = end;
+    buffer->numPushed.store(idx + 1, std::memory_order_release);
+}
+
+void traceEvent(const char* const name, const long long begin, const long long end)
+{
+    pushTraceEvent('X', getTraceThreadId(), name, nullptr, -1, begin, end);
+}
+
+void traceEvent(const char* const name, const char* const detail, const long long begin,
+                const long long end)
+{
+    pushTraceEvent('X', getTraceThreadId(), name, detail, -1, begin, end);
+}
+
+void traceThreadEvent(const int thread, const char* const name, const long long begin,
+                      const long long end)
+{
+    pushTraceEvent('X', thread, name, nullptr, -1, begin, end);
+}
+
+void traceInstant(const char* const name)
+{
+    const long long time = getTimeNs();
+    pushTraceEvent('i', getTraceThreadId(), name, nullptr, -1, time, time);
+}
+
+static void writeTraceString(const char* str)
+{
+    for(; *str; ++str)
+    {
+        if(*str == '"' || *str == '\\')
+            fputc('\\', trace.file);
+
+        // control characters are not valid in JSON strings
+        fputc((unsigned char)*str < 0x20 ? ' ' : *str, trace.file);
+    }
+}
+
+// timestamps are microseconds from the start of the trace
+static void writeTraceEvent(const TraceEvent& e)
+{
+    fputs(trace.numWritten ? ",\n{\"name\":\"" : "{\"name\":\"", trace.file);
+    writeTraceString(e.name);
+
+    if(e.detail[0])
+    {
+        fputc(' ', trace.file);
+        writeTraceString(e.detail);
+    }
+
+    if(e.arg >= 0)
+        fprintf(trace.file, " %d", e.arg);
+
+    fprintf(trace.file, "\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", e.phase, e.thread,
+            (e.begin - trace.startTime) / 1000.0);
+
+    if(e.phase == 'X')
+        fprintf(trace.file, ",\"dur\":%.3f}", (e.end - e.begin) / 1000.0);
+    else
+        fputs(",\"s\":\"g\"}", trace.file); // a line across all threads
+
+    ++trace.numWritten;
+}
+
+// returns the number of events written
+static int drainTraceBuffers()
+{
+    PROFILE_SCOPE("drainTraceBuffers");
+    const int numBuffers = trace.numBuffers.load(std::memory_order_acquire);
+    int count = 0;
+
+    for(int i = 0; i < numBuffers; ++i)
+    {
+        TraceBuffer& buffer = *trace.buffers[i];
+        const unsigned numPushed = buffer.numPushed.load(std::memory_order_acquire);
+        unsigned idx = buffer.numPopped.load(std::memory_order_relaxed);
+
+        for(; idx != numPushed; ++idx)
+        {
+            const TraceEvent& e = buffer.events[idx & (traceBufferSize - 1)];
+
+            // pushed before the trace started (recording was still set from the previous one)
+            if(e.begin < trace.startTime)
+                continue;
+
+            writeTraceEvent(e);
+            ++count;
+        }
+
+        buffer.numPopped.store(numPushed, std::memory_order_release);
+    }
+
+    return count;
+}
+
+// formatting and writes happen here, the recording threads only copy the events
+static void traceWriterThreadFunc()
+{
+    setThreadName("trace writer");
+    std::unique_lock<std::mutex> lock(trace.mutex);
+
+    while(true)
+    {
+        const bool quit = trace.quitSet.wait_for(lock,
+                                                 std::chrono::milliseconds(traceWriterSleepMs),
+                                                 []{return trace.quit;});
+        lock.unlock();
+        drainTraceBuffers();
+        lock.lock();
+
+        // recording is already off, nothing is pushed after this drain
+        if(quit)
+            return;
+    }
+}
+
+bool startTrace(const char* const filename, const float seconds)
+{
+    assert(!trace.active);
+    trace.file = fopen(filename, "w");
+
+    if(!trace.file)
+    {
+        printf("startTrace() could not open file: %s\n", filename);
+        return false;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", trace.file);
+
+    trace.active = true;
+    trace.startTime = getTimeNs();
+    trace.stopTime = seconds > 0.f ? trace.startTime + (long long)(seconds * 1e9) : 0;
+    trace.numWritten = 0;
+    trace.numFrames = 0;
+    trace.frameBegin = 0;
+
+    glGenQueries(traceGpuRingSize * 2, &trace.queries[0][0]);
+    trace.gpuHead = 0;
+    trace.gpuCount = 0;
+    trace.gpuFrame = false;
+
+    // the gpu clock has its own epoch, they are aligned once (no drift correction)
+    GLint64 gpuTime;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    trace.gpuOffset = getTimeNs() - gpuTime;
+
+    {
+        std::lock_guard<std::mutex> lock(trace.mutex);
+        trace.quit = false;
+        trace.recording.store(true, std::memory_order_release);
+    }
+
+    trace.writer = std::thread(traceWriterThreadFunc);
+    printf("trace: %s\n", filename);
+    return true;
+}
+
+bool isTracing()
+{
+    return trace.active;
+}
+
+void traceBeginFrame()
+{
+    if(!trace.active)
+        return;
+
+    trace.frameBegin = getTimeNs();
+    trace.gpuFrame = trace.gpuCount < traceGpuRingSize;
+
+    if(trace.gpuFrame)
+        glQueryCounter(trace.queries[trace.gpuHead][0], GL_TIMESTAMP);
+}
+
+// reads the finished gpu frames, wait - block on the oldest ones (stopTrace())
+static void retireTraceGpuFrames(const bool wait)
+{
+    while(trace.gpuCount)
+    {
+        const int idx = (trace.gpuHead - trace.gpuCount + traceGpuRingSize) % traceGpuRingSize;
+        GLint available = GL_TRUE;
+
+        // the end query completes after the begin query
+        if(!wait)
+            glGetQueryObjectiv(trace.queries[idx][1], GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if(!available)
+            return;
+
+        GLint64 begin, end;
+        glGetQueryObjecti64v(trace.queries[idx][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjecti64v(trace.queries[idx][1], GL_QUERY_RESULT, &end);
+        --trace.gpuCount;
+
+        pushTraceEvent('X', traceGpuThread, "gpu frame", nullptr, -1, begin + trace.gpuOffset,
+                       end + trace.gpuOffset);
+    }
+}
+
+void traceEndFrame()
+{
+    if(!trace.active || !trace.frameBegin)
+        return;
+
+    const long long now = getTimeNs();
+    pushTraceEvent('X', getTraceThreadId(), "frame", nullptr, trace.numFrames, trace.frameBegin,
+                   now);
+    ++trace.numFrames;
+
+    if(trace.gpuFrame)
+    {
+        glQueryCounter(trace.queries[trace.gpuHead][1], GL_TIMESTAMP);
+        trace.gpuHead = (trace.gpuHead + 1) % traceGpuRingSize;
+        ++trace.gpuCount;
+    }
+
+    retireTraceGpuFrames(false);
+
+    if(trace.stopTime && now >= trace.stopTime)
+        stopTrace();
+}
+
+void stopTrace()
+{
+    if(!trace.active)
+        return;
+
+    retireTraceGpuFrames(true);
+    glDeleteQueries(traceGpuRingSize * 2, &trace.queries[0][0]);
+
+    {
+        std::lock_guard<std::mutex> lock(trace.mutex);
+        trace.recording.store(false, std::memory_order_relaxed);
+        trace.quit = true;
+        trace.quitSet.notify_one();
+    }
+
+    trace.writer.join();
+    int numDropped = 0;
+
+    for(int i = 0; i < trace.numBuffers.load(std::memory_order_acquire); ++i)
+        numDropped += trace.buffers[i]->numDropped.exchange(0, std::memory_order_relaxed);
+
+    // thread names, the metadata events can be anywhere in the file
+    const int numThreads = min(traceMaxThreads, traceNumThreads.load(std::memory_order_relaxed));
+
+    for(int i = 0; i <= numThreads; ++i)
+    {
+        char name[32];
+        {
+            std::lock_guard<std::mutex> lock(trace.mutex);
+            snprintf(name, sizeof(name), "%s", i == numThreads ? "gpu" : trace.threadNames[i]);
+        }
+
+        if(!name[0])
+            continue;
+
+        fputs(trace.numWritten ? ",\n" : "", trace.file);
+        fprintf(trace.file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                            "\"args\":{\"name\":\"", i == numThreads ? traceGpuThread : i);
+        writeTraceString(name);
+        fputs("\"}}", trace.file);
+        ++trace.numWritten;
+    }
+
+    fputs("\n]}\n", trace.file);
+    fclose(trace.file);
+    trace.active = false;
+    printf("trace: %d frames, %d events written, %d dropped (full buffers)\n", trace.numFrames,
+           trace.numWritten, numDropped);
+}
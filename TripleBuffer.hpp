@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+
+// lock-free handoff of the latest value from one writer thread to one reader thread
+// the writer fills getWriteBuffer() and publishes it, the reader calls acquire() and reads
+// getReadBuffer(); neither side ever waits and each owns its buffer until the next call
+// values published between two acquire() calls are dropped, only the newest one is seen
+template<typename T>
+class TripleBuffer
+{
+public:
+	T& getWriteBuffer() { return buffers_[writeIdx_]; }
+
+	void publish()
+	{
+		writeIdx_ = middle_.exchange(writeIdx_ | NewBit, std::memory_order_acq_rel) & IdxMask;
+	}
+
+	// returns false if nothing was published since the last call, getReadBuffer() is unchanged
+	bool acquire()
+	{
+		if (!(middle_.load(std::memory_order_relaxed) & NewBit))
+			return false;
+
+		readIdx_ = middle_.exchange(readIdx_, std::memory_order_acq_rel) & IdxMask;
+		return true;
+	}
+
+	const T& getReadBuffer() const { return buffers_[readIdx_]; }
+
+private:
+	enum
+	{
+		IdxMask = 3,
+		NewBit = 4
+	};
+
+	T buffers_[3];
+	int writeIdx_ = 0;
+	std::atomic<int> middle_{1}; // index of the spare buffer | NewBit if it is unread
+	int readIdx_ = 2;
+};
@@ -0,0 +1,60 @@
+// offline font atlas baker, see FontAtlas.hpp
+// usage: fontBaker <font file> <font size> <texture width> [sdf]
+// writes <font file>.<font size>_<texture width>[_sdf].atlas next to the font file
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "imgui/stb_truetype.h"
+#include "FontAtlas.cpp"
+
+int main(int argc, char** argv)
+{
+    if(argc != 4 && !(argc == 5 && strcmp(argv[4], "sdf") == 0))
+    {
+        printf("usage: fontBaker <font file> <font size> <texture width> [sdf]\n");
+        return EXIT_FAILURE;
+    }
+
+    const char* const fontFilename = argv[1];
+    const int fontSize = atoi(argv[2]);
+    const int textureWidth = atoi(argv[3]);
+    const bool sdf = argc == 5;
+
+    FILE* fp = fopen(fontFilename, "rb");
+    if(!fp)
+    {
+        printf("could not open file: %s\n", fontFilename);
+        return EXIT_FAILURE;
+    }
+
+    Array<unsigned char> buffer;
+    {
+        fseek(fp, 0, SEEK_END);
+        const int size = ftell(fp);
+        rewind(fp);
+        buffer.resize(size);
+        fread(buffer.data(), sizeof(char), buffer.size(), fp);
+        fclose(fp);
+    }
+
+    FontAtlas atlas;
+
+    if(!bakeFontAtlas(buffer.data(), fontSize, textureWidth, sdf, atlas))
+        return EXIT_FAILURE;
+
+    char atlasFilename[512];
+    getFontAtlasFilename(atlasFilename, sizeof(atlasFilename), fontFilename, fontSize,
+                         textureWidth, sdf);
+
+    if(!writeFontAtlas(atlasFilename, fontFilename, fontSize, textureWidth, sdf, atlas))
+        return EXIT_FAILURE;
+
+    printf("%s: %d x %d\n", atlasFilename, atlas.size.x, atlas.size.y);
+    return EXIT_SUCCESS;
+}
@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <time.h>
+#include <chrono>
+#include <thread>
 #include "imgui/imgui.h"
 //#include "imgui/imgui_impl_glfw_gl3.h"
 #include "Array.hpp"
@@ -15,8 +17,30 @@
 #include "math.hpp"
 #include "fmod/fmod_errors.h"
 
+#include "AssetPack.hpp"
+#include "Profiler.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
 // unity build
 #include "GameScene.cpp"
+#include "Resources.cpp"
+#include "Replay.cpp"
+#include "Capture.cpp"
+#include "Latency.cpp"
+#include "Profiler.cpp"
+#include "Trace.cpp"
+#include "GpuTimer.cpp"
+#include "GLState.cpp"
 #include "glad.c"
 #include "imgui/imgui.cpp"
 #include "imgui/imgui_demo.cpp"
@@ -30,61 +54,203 @@
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "imgui/stb_truetype.h"
 
-static GLint getUniformLocation(GLuint program, const char* const name)
-{
-    GLint loc = glGetUniformLocation(program, name);
-    if(loc == -1)
-        printf("program = %u: unfiform '%s' is inactive\n", program, name);
-    return loc;
-}
-
-// @TODO(matiTechno): inline?
+#include "FontAtlas.cpp"
+#include "GlyphCache.cpp"
 
-void uniformMat4(const GLuint program, const char* const name, const mat4& m)
+static struct
 {
-    glUniformMatrix4fv(getUniformLocation(program, name), 1, false, &m[0][0]);
-}
+    MappedFile file;
+    const AssetPackHeader* header = nullptr;
+} assetPack;
 
-void uniform1i(const GLuint program, const char* const name, const int i)
+static MappedFile mapLooseFile(const char* const filename)
 {
-    glUniform1i(getUniformLocation(program, name), i);
-}
+    MappedFile file = {nullptr, 0, nullptr};
 
-void uniform1f(const GLuint program, const char* const name, const float f)
-{
-    glUniform1f(getUniformLocation(program, name), f);
+#ifdef _WIN32
+    HANDLE const fileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if(fileHandle == INVALID_HANDLE_VALUE)
+        return file;
+
+    const DWORD size = GetFileSize(fileHandle, nullptr);
+    HANDLE const mapping = size ? CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0,
+                                                     nullptr) : nullptr;
+    CloseHandle(fileHandle);
+
+    if(!mapping)
+        return file;
+
+    const void* const data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if(!data)
+    {
+        CloseHandle(mapping);
+        return file;
+    }
+
+    file.data = (const unsigned char*)data;
+    file.size = size;
+    file.handle = mapping;
+#else
+    const int fd = open(filename, O_RDONLY);
+
+    if(fd == -1)
+        return file;
+
+    struct stat s;
+
+    if(fstat(fd, &s) != 0 || s.st_size == 0)
+    {
+        close(fd);
+        return file;
+    }
+
+    void* const data = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+
+    if(data == MAP_FAILED)
+        return file;
+
+    file.data = (const unsigned char*)data;
+    file.size = s.st_size;
+#endif
+
+    return file;
 }
 
-void uniform2f(const GLuint program, const char* const name, const float f1, const float f2)
+MappedFile mapFile(const char* const filename)
 {
-    glUniform2f(getUniformLocation(program, name), f1, f2);
+    if(assetPack.header)
+    {
+        const AssetPackEntry* const entry = findAssetPackEntry(*assetPack.header, filename);
+
+        // a view, unmapFile() leaves the pack mapped
+        if(entry)
+            return {assetPack.file.data + entry->offset, int(entry->size), &assetPack};
+    }
+
+    return mapLooseFile(filename);
 }
 
-void uniform2f(const GLuint program, const char* const name, const vec2 v)
+void unmapFile(MappedFile& file)
 {
-    glUniform2f(getUniformLocation(program, name), v.x, v.y);
+    if(!file.data)
+        return;
+
+    if(file.handle == &assetPack)
+    {
+        file.data = nullptr;
+        file.size = 0;
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle(file.handle);
+#else
+    munmap((void*)file.data, file.size);
+#endif
+
+    file.data = nullptr;
+    file.size = 0;
 }
 
-void uniform3f(const GLuint program, const char* const name, const float f1, const float f2,
-               const float f3)
+// with the trailing separator, empty on failure
+static void getExecutableDir(char* const buffer, const int bufferSize)
 {
-    glUniform3f(getUniformLocation(program, name), f1, f2, f3);
+    int size = 0;
+
+#if defined(_WIN32)
+    size = GetModuleFileNameA(nullptr, buffer, bufferSize);
+
+    if(size == bufferSize)
+        size = 0;
+#elif defined(__APPLE__)
+    uint32_t appleSize = bufferSize;
+
+    if(_NSGetExecutablePath(buffer, &appleSize) == 0)
+        size = strlen(buffer);
+#else
+    size = readlink("/proc/self/exe", buffer, bufferSize - 1);
+    size = max(size, 0);
+#endif
+
+    buffer[size] = '\0';
+
+    for(int i = size - 1; i >= 0; --i)
+    {
+        if(buffer[i] == '/' || buffer[i] == '\\')
+            break;
+
+        buffer[i] = '\0';
+    }
 }
 
-void uniform3f(const GLuint program, const char* const name, const vec3 v)
+// every entry is checked once here, mapFile() trusts the table
+static bool isAssetPackValid(const MappedFile& file)
 {
-    glUniform3f(getUniformLocation(program, name), v.x, v.y, v.z);
+    const AssetPackHeader* const header = (const AssetPackHeader*)file.data;
+
+    if(file.size < int(sizeof(AssetPackHeader)) || memcmp(header->magic, "APAK", 4) != 0 ||
+       header->version != assetPackVersion || header->tableSize <= 0 ||
+       (header->tableSize & (header->tableSize - 1)) ||
+       (file.size - int(sizeof(AssetPackHeader))) / int(sizeof(AssetPackEntry)) <
+       header->tableSize)
+        return false;
+
+    const AssetPackEntry* const table = (const AssetPackEntry*)(header + 1);
+    int numEmpty = 0;
+
+    for(int i = 0; i < header->tableSize; ++i)
+    {
+        const AssetPackEntry& entry = table[i];
+
+        if(!entry.hash)
+        {
+            ++numEmpty;
+            continue;
+        }
+
+        if(entry.offset < 0 || entry.size < 0 || entry.size > file.size - entry.offset ||
+           !memchr(entry.name, '\0', sizeof(entry.name)))
+            return false;
+    }
+
+    // the lookup stops at an empty slot
+    return numEmpty > 0;
 }
 
-void uniform4f(const GLuint program, const char* const name, const float f1, const float f2,
-               const float f3, const float f4)
+bool openAssetPack(const char* const filename)
 {
-    glUniform4f(getUniformLocation(program, name), f1, f2, f3, f4);
+    char path[1024];
+    getExecutableDir(path, sizeof(path));
+    strncat(path, filename, sizeof(path) - strlen(path) - 1);
+
+    MappedFile file = mapLooseFile(path);
+
+    if(!file.data)
+        return false;
+
+    if(!isAssetPackValid(file))
+    {
+        printf("invalid asset pack: %s\n", path);
+        unmapFile(file);
+        return false;
+    }
+
+    const AssetPackHeader* const header = (const AssetPackHeader*)file.data;
+    assetPack.file = file;
+    assetPack.header = header;
+    printf("asset pack: %s (%d files)\n", path, header->numEntries);
+    return true;
 }
 
-void uniform4f(const GLuint program, const char* const name, const vec4 v)
+void closeAssetPack()
 {
-    glUniform4f(getUniformLocation(program, name), v.x, v.y, v.z, v.w);
+    assetPack.header = nullptr;
+    unmapFile(assetPack.file);
 }
 
 static void errorCallback(const int error, const char* const description)
@@ -93,12 +259,6 @@ static void errorCallback(const int error, const char* const description)
     printf("GLFW error: %s\n", description);
 }
 
-void bindTexture(const Texture& texture, const GLuint unit)
-{
-    glActiveTexture(GL_TEXTURE0 + unit);
-    glBindTexture(GL_TEXTURE_2D, texture.id);
-}
-
 // @TODO(matiTechno): functions for setting texture sampling type
 // delete with deleteTexture()
 static Texture createDefaultTexture()
@@ -118,6 +278,45 @@ static Texture createDefaultTexture()
 
 // delete with deleteTexture()
 Texture createTextureFromFile(const char* const filename)
+{
+    ImageData image;
+    loadImageData(filename, image);
+    const Texture tex = createTextureFromData(image);
+    freeImageData(image);
+    return tex;
+}
+
+bool loadImageData(const char* const filename, ImageData& image)
+{
+    MappedFile file = mapFile(filename);
+    image.pixels = nullptr;
+
+    if(file.data)
+    {
+        image.pixels = stbi_load_from_memory(file.data, file.size, &image.size.x,
+                                             &image.size.y, nullptr, 4);
+    }
+
+    unmapFile(file);
+
+    if(!image.pixels)
+    {
+        printf("stbi_load() failed: %s\n", filename);
+        image.size = {0, 0};
+        return false;
+    }
+
+    return true;
+}
+
+void freeImageData(ImageData& image)
+{
+    stbi_image_free(image.pixels);
+    image.pixels = nullptr;
+}
+
+// delete with deleteTexture()
+Texture createTextureFromData(const ImageData& image, const bool fromUnpackBuffer)
 {
     Texture tex;
     glGenTextures(1, &tex.id);
@@ -125,12 +324,8 @@ Texture createTextureFromFile(const char* const filename)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    unsigned char* const data = stbi_load(filename, &tex.size.x, &tex.size.y,
-                                          nullptr, 4);
-
-    if(!data)
+    if(!image.pixels && !fromUnpackBuffer)
     {
-        printf("stbi_load() failed: %s\n", filename);
         tex.size = {1, 1};
         const unsigned char color[] = {0, 255, 0, 255};
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex.size.x, tex.size.y, 0,
@@ -138,10 +333,9 @@ Texture createTextureFromFile(const char* const filename)
     }
     else
     {
+        tex.size = image.size;
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex.size.x, tex.size.y, 0,
-                GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-        stbi_image_free(data);
+                GL_RGBA, GL_UNSIGNED_BYTE, fromUnpackBuffer ? nullptr : image.pixels);
     }
 
     return tex;
@@ -149,130 +343,138 @@ Texture createTextureFromFile(const char* const filename)
 
 void deleteTexture(const Texture& texture)
 {
+    forgetGLTexture(texture.id);
     glDeleteTextures(1, &texture.id);
 }
 
-// delete with deleteFont()
-Font createFontFromFile(const char* const filename, const int fontSize, const int textureWidth)
+// bitmap - GL_R8, atlasSize, might be an offset into the bound GL_PIXEL_UNPACK_BUFFER
+// the texture also gets the glyph cache pages below the atlas (cleared on the first use)
+static void uploadFontTexture(Font& font, const char* const filename, const int fontSize,
+                              const ivec2 atlasSize, const unsigned char* const bitmap)
 {
-    Font font;
-    font.texture = createDefaultTexture();
+    font.glyphCache = createGlyphCache(filename, fontSize, font.sdf, atlasSize.x, atlasSize.y);
+    font.texture.size = font.glyphCache->textureSize;
 
-    FILE* fp = fopen(filename, "rb");
-    if(!fp)
-    {
-        printf("createFontFromFile() could not open file: %s\n", filename);
-        return font;
-    }
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    Array<unsigned char> buffer;
-    {
-        fseek(fp, 0, SEEK_END);
-        const int size = ftell(fp);
-        rewind(fp);
-        buffer.resize(size);
-        fread(buffer.data(), sizeof(char), buffer.size(), fp);
-        fclose(fp);
-    }
+    bindTexture(font.texture);
 
-    stbtt_fontinfo fontInfo;
+    // allocation only, nothing is read from the unpack buffer
+    GLint unpackBuffer;
+    glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &unpackBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-    if(stbtt_InitFont(&fontInfo, buffer.data(), 0) == 0)
-    {
-        printf("stbtt_InitFont() failed: %s\n", filename);
-        return font;
-    }
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, font.texture.size.x, font.texture.size.y, 0,
+                 GL_RED, GL_UNSIGNED_BYTE, nullptr);
 
-    const float scale = stbtt_ScaleForPixelHeight(&fontInfo, fontSize);
-    float ascent;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
 
-    {
-        int descent, lineSpace, ascent_;
-        stbtt_GetFontVMetrics(&fontInfo, &ascent_, &descent, &lineSpace);
-        font.lineSpace = (ascent_ - descent + lineSpace) * scale;
-        ascent = ascent_ * scale;
-    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, atlasSize.x, atlasSize.y, GL_RED,
+                    GL_UNSIGNED_BYTE, bitmap);
 
-    unsigned char* bitmaps[127];
-    int maxBitmapSizeY = 0;
-    ivec2 pos = {0, 0};
-    for(int i = 32; i < 127; ++i)
-    {
-        const int idx = stbtt_FindGlyphIndex(&fontInfo, i);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+}
 
-        if(idx == 0)
-        {
-            printf("stbtt_FindGlyphIndex(%d) failed\n", i);
-            continue;
-        }
+// delete with deleteFont()
+Font createFontFromFile(const char* const filename, const int fontSize, const int textureWidth,
+                        const bool sdf)
+{
+    PROFILE_SCOPE("createFontFromFile");
+    FontData data;
+    loadFontData(filename, fontSize, textureWidth, sdf, data);
+    const Font font = createFontFromData(data);
+    freeFontData(data);
+    return font;
+}
 
-        Glyph& glyph = font.glyphs[i];
-        int advance;
-        int dummy;
-        stbtt_GetGlyphHMetrics(&fontInfo, idx, &advance, &dummy);
-        glyph.advance = advance * scale;
+bool loadFontData(const char* const filename, const int fontSize, const int textureWidth,
+                  const bool sdf, FontData& data)
+{
+    snprintf(data.filename, sizeof(data.filename), "%s", filename);
+    data.fontSize = fontSize;
+    data.sdf = sdf;
+    data.file = {nullptr, 0, nullptr};
+    data.bitmap = nullptr;
 
-        ivec2 offset;
-        ivec2 size;
-        bitmaps[i] = stbtt_GetGlyphBitmap(&fontInfo, scale, scale, idx, &size.x, &size.y,
-                                          &offset.x, &offset.y);
+    // offline baked atlas
+    {
+        char atlasFilename[512];
+        getFontAtlasFilename(atlasFilename, sizeof(atlasFilename), filename, fontSize,
+                             textureWidth, sdf);
 
-        assert(size.x <= textureWidth);
-        glyph.offset.x = offset.x;
-        glyph.offset.y = ascent + offset.y;
-        glyph.texRect.z = size.x;
-        glyph.texRect.w = size.y;
+        data.file = mapFile(atlasFilename);
 
-        if(pos.x + glyph.texRect.z > textureWidth)
+        const FontAtlasHeader* const header = validateFontAtlas(data.file.data, data.file.size,
+                                                                filename, fontSize,
+                                                                textureWidth, sdf);
+        if(header)
         {
-            pos.x = 0;
-            pos.y += maxBitmapSizeY + 1;
-            maxBitmapSizeY = 0;
+            memcpy(data.atlas.glyphs, header->glyphs, sizeof(data.atlas.glyphs));
+            data.atlas.lineSpace = header->lineSpace;
+            data.atlas.size = header->size;
+            data.bitmap = data.file.data + sizeof(FontAtlasHeader);
+            return true;
         }
 
-        glyph.texRect.x = pos.x;
-        glyph.texRect.y = pos.y;
-
-        pos.x += glyph.texRect.z + 1;
-        maxBitmapSizeY = max(maxBitmapSizeY, int(glyph.texRect.w));
+        unmapFile(data.file);
     }
 
-    font.texture.size = {textureWidth, pos.y + maxBitmapSizeY};
+    MappedFile fontFile = mapFile(filename);
 
-    Array<unsigned char> clearBuf;
-    clearBuf.resize(font.texture.size.x * font.texture.size.y);
-    memset(clearBuf.data(), 0, clearBuf.size());
-
-    GLint unpackAlignment;
-    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-    bindTexture(font.texture);
+    if(!fontFile.data)
+    {
+        printf("createFontFromFile() could not open file: %s\n", filename);
+        return false;
+    }
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, font.texture.size.x, font.texture.size.y, 0,
-                 GL_RED, GL_UNSIGNED_BYTE, clearBuf.data());
+    const bool baked = bakeFontAtlas(fontFile.data, fontSize, textureWidth, sdf, data.atlas);
+    unmapFile(fontFile);
 
-    for(int i = 32; i < 127; ++i)
+    if(!baked)
     {
-        const vec4& texRect = font.glyphs[i].texRect;
-        glTexSubImage2D(GL_TEXTURE_2D, 0, texRect.x, texRect.y, texRect.z, texRect.w,
-                        GL_RED, GL_UNSIGNED_BYTE, bitmaps[i]);
+        printf("bakeFontAtlas() failed: %s\n", filename);
+        return false;
     }
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+    data.bitmap = data.atlas.bitmap.data();
+    return true;
+}
 
+void freeFontData(FontData& data)
+{
+    unmapFile(data.file);
+    data.atlas.bitmap.clear();
+    data.bitmap = nullptr;
+}
 
-    for(int i = 32; i < 127; ++i)
-    {
-        stbtt_FreeBitmap(bitmaps[i], nullptr);
-    }
+// delete with deleteFont()
+Font createFontFromData(const FontData& data, const bool fromUnpackBuffer)
+{
+    Font font;
+    font.texture = createDefaultTexture();
+    font.sdf = data.sdf;
+    font.glyphCache = nullptr;
 
+    if(!data.bitmap && !fromUnpackBuffer)
+        return font;
+
+    memcpy(font.glyphs, data.atlas.glyphs, sizeof(font.glyphs));
+    font.lineSpace = data.atlas.lineSpace;
+    uploadFontTexture(font, data.filename, data.fontSize, data.atlas.size,
+                      fromUnpackBuffer ? nullptr : data.bitmap);
     return font;
 }
 
 void deleteFont(Font& font)
 {
     deleteTexture(font.texture);
+
+    if(font.glyphCache)
+        deleteGlyphCache(font.glyphCache);
+
+    font.glyphCache = nullptr;
 }
 
 const char* const vertexSrc = R"(
@@ -348,9 +550,225 @@ void main()
         float alpha = texture(sampler, vTexCoord).r;
         color *= alpha;
     }
+    else if(mode == 3)
+    {
+        // signed distance field, the edge is at 0.5
+        // antialiasing width follows the screen space scale of the glyph
+        float dist = texture(sampler, vTexCoord).r;
+        float width = fwidth(dist);
+        color *= smoothstep(0.5 - width, 0.5 + width, dist);
+    }
 }
 )";
 
+// FNV-1a
+static unsigned long long hashBytes(const void* const data, const int size,
+                                    unsigned long long hash = 14695981039346656037ull)
+{
+    const unsigned char* const bytes = (const unsigned char*)data;
+
+    for(int i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// not in our glad (GL 3.3 core), GL_ARB_get_program_binary (core in 4.1) and
+// GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length,
+                                              GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat,
+                                           const void* binary, GLsizei length);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+struct ProgramBinaryHeader
+{
+    char magic[4]; // PBIN
+    unsigned long long key;
+    GLenum format;
+    int size;
+};
+
+struct PendingProgram
+{
+    unsigned long long key;
+    GLuint program;
+    // 0 if the program was loaded from a binary
+    GLuint vertex;
+    GLuint fragment;
+};
+
+static struct
+{
+    GetProgramBinaryProc getProgramBinary = nullptr;
+    ProgramBinaryProc programBinary = nullptr;
+    ProgramParameteriProc programParameteri = nullptr;
+    unsigned long long driverHash = 0;
+    char dir[1024] = {}; // with the trailing separator
+    Array<PendingProgram> pending; // prefetchProgram()
+} programCache;
+
+static bool hasGLExtension(const char* const name)
+{
+    GLint numExtensions;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+
+    for(int i = 0; i < numExtensions; ++i)
+    {
+        if(strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+void initProgramCache()
+{
+    // binaries are only valid for the driver that produced them
+    const GLenum strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+
+    for(const GLenum name: strings)
+    {
+        const char* const str = (const char*)glGetString(name);
+        programCache.driverHash = hashBytes(str, strlen(str), programCache.driverHash);
+    }
+
+    GLint major, minor;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+    if(major * 10 + minor >= 41 || hasGLExtension("GL_ARB_get_program_binary"))
+    {
+        programCache.getProgramBinary =
+            (GetProgramBinaryProc)glfwGetProcAddress("glGetProgramBinary");
+        programCache.programBinary = (ProgramBinaryProc)glfwGetProcAddress("glProgramBinary");
+        programCache.programParameteri =
+            (ProgramParameteriProc)glfwGetProcAddress("glProgramParameteri");
+    }
+
+    if(!programCache.getProgramBinary || !programCache.programBinary)
+    {
+        programCache.getProgramBinary = nullptr;
+        programCache.programBinary = nullptr;
+        printf("program binaries are not supported\n");
+    }
+
+    MaxShaderCompilerThreadsProc maxThreads = nullptr;
+
+    if(hasGLExtension("GL_KHR_parallel_shader_compile"))
+    {
+        maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress(
+                         "glMaxShaderCompilerThreadsKHR");
+    }
+    else if(hasGLExtension("GL_ARB_parallel_shader_compile"))
+    {
+        maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress(
+                         "glMaxShaderCompilerThreadsARB");
+    }
+
+    // as many as the driver wants
+    if(maxThreads)
+        maxThreads(0xFFFFFFFF);
+
+    getExecutableDir(programCache.dir, sizeof(programCache.dir));
+    strncat(programCache.dir, "shadercache/", sizeof(programCache.dir) -
+                                              strlen(programCache.dir) - 1);
+#ifdef _WIN32
+    CreateDirectoryA(programCache.dir, nullptr);
+#else
+    mkdir(programCache.dir, 0755);
+#endif
+}
+
+static unsigned long long getProgramKey(const char* const vertexSrc,
+                                        const char* const fragmentSrc)
+{
+    unsigned long long key = hashBytes(vertexSrc, strlen(vertexSrc), programCache.driverHash);
+    key = hashBytes("", 1, key); // separator
+    key = hashBytes(fragmentSrc, strlen(fragmentSrc), key);
+    return key + (key == 0);
+}
+
+static void getProgramBinaryFilename(char* const buffer, const int bufferSize,
+                                     const unsigned long long key)
+{
+    snprintf(buffer, bufferSize, "%s%016llx.bin", programCache.dir, key);
+}
+
+// returns 0 on a cache miss
+static GLuint loadProgramBinary(const unsigned long long key)
+{
+    if(!programCache.programBinary)
+        return 0;
+
+    char filename[1100];
+    getProgramBinaryFilename(filename, sizeof(filename), key);
+    MappedFile file = mapLooseFile(filename);
+
+    if(!file.data)
+        return 0;
+
+    const ProgramBinaryHeader* const header = (const ProgramBinaryHeader*)file.data;
+    GLuint program = 0;
+
+    if(file.size >= int(sizeof(ProgramBinaryHeader)) && memcmp(header->magic, "PBIN", 4) == 0 &&
+       header->key == key && file.size == int(sizeof(ProgramBinaryHeader)) + header->size)
+    {
+        program = glCreateProgram();
+        programCache.programBinary(program, header->format, header + 1, header->size);
+
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+        // the driver rejects binaries it can't use (e.g. after an update)
+        if(success != GL_TRUE)
+        {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+
+    unmapFile(file);
+    return program;
+}
+
+static void saveProgramBinary(const GLuint program, const unsigned long long key)
+{
+    if(!programCache.getProgramBinary)
+        return;
+
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+
+    if(size <= 0)
+        return;
+
+    Array<unsigned char> buffer;
+    buffer.resize(sizeof(ProgramBinaryHeader) + size);
+    ProgramBinaryHeader& header = *(ProgramBinaryHeader*)buffer.data();
+    memcpy(header.magic, "PBIN", 4);
+    header.key = key;
+    programCache.getProgramBinary(program, size, &header.size, &header.format, &header + 1);
+
+    char filename[1100];
+    getProgramBinaryFilename(filename, sizeof(filename), key);
+    FILE* const fp = fopen(filename, "wb");
+
+    if(!fp)
+        return;
+
+    fwrite(buffer.data(), 1, sizeof(ProgramBinaryHeader) + header.size, fp);
+    fclose(fp);
+}
+
 // returns true on error
 static bool isCompileError(const GLuint shader)
 {
@@ -368,56 +786,135 @@ static bool isCompileError(const GLuint shader)
     }
 }
 
-// returns 0 on failure
-// program must be deleted with deleteProgram() (if != 0)
-GLuint createProgram(const char* const vertexSrc, const char* const fragmentSrc)
+// issues the compile and link without waiting for the results
+static PendingProgram startProgram(const char* const vertexSrc, const char* const fragmentSrc,
+                                   const unsigned long long key)
 {
-    const GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vertexSrc, nullptr);
-    glCompileShader(vertex);
+    PendingProgram p;
+    p.key = key;
+
+    p.vertex = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(p.vertex, 1, &vertexSrc, nullptr);
+    glCompileShader(p.vertex);
+
+    p.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(p.fragment, 1, &fragmentSrc, nullptr);
+    glCompileShader(p.fragment);
+
+    p.program = glCreateProgram();
+
+    if(programCache.programParameteri)
+        programCache.programParameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    glAttachShader(p.program, p.vertex);
+    glAttachShader(p.program, p.fragment);
+    glLinkProgram(p.program);
+    return p;
+}
+
+// waits for the results, returns 0 on failure
+static GLuint finishProgram(const PendingProgram& p)
+{
+    if(!p.vertex)
+        return p.program;
+
+    glDetachShader(p.program, p.vertex);
+    glDetachShader(p.program, p.fragment);
 
-    const GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fragmentSrc, nullptr);
-    glCompileShader(fragment);
-    
     {
-        const bool vertexError = isCompileError(vertex);
-        const bool fragmentError = isCompileError(fragment);
+        const bool vertexError = isCompileError(p.vertex);
+        const bool fragmentError = isCompileError(p.fragment);
+        glDeleteShader(p.vertex);
+        glDeleteShader(p.fragment);
 
         if(vertexError || fragmentError)
         {
-            glDeleteShader(vertex);
-            glDeleteShader(fragment);
+            glDeleteProgram(p.program);
             return 0;
         }
     }
 
-    const GLuint program = glCreateProgram();
-    glAttachShader(program, vertex);
-    glAttachShader(program, fragment);
-    glLinkProgram(program);
-    glDetachShader(program, vertex);
-    glDetachShader(program, fragment);
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
-
     GLint success;
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    glGetProgramiv(p.program, GL_LINK_STATUS, &success);
     
     if(success == GL_TRUE)
-        return program;
+    {
+        saveProgramBinary(p.program, p.key);
+        return p.program;
+    }
     else
     {
-        glDeleteProgram(program);
         char buffer[512];
-        glGetProgramInfoLog(program, sizeof(buffer), nullptr, buffer);
+        glGetProgramInfoLog(p.program, sizeof(buffer), nullptr, buffer);
+        glDeleteProgram(p.program);
         printf("glLinkProgram() error:\n%s\n", buffer);
         return 0;
     }
 }
 
+void prefetchProgram(const char* const vertexSrc, const char* const fragmentSrc)
+{
+    const unsigned long long key = getProgramKey(vertexSrc, fragmentSrc);
+
+    for(const PendingProgram& p: programCache.pending)
+    {
+        if(p.key == key)
+            return;
+    }
+
+    const GLuint cached = loadProgramBinary(key);
+
+    if(cached)
+        programCache.pending.pushBack({key, cached, 0, 0});
+    else
+        programCache.pending.pushBack(startProgram(vertexSrc, fragmentSrc, key));
+}
+
+// returns 0 on failure
+// program must be deleted with deleteProgram() (if != 0)
+GLuint createProgram(const char* const vertexSrc, const char* const fragmentSrc)
+{
+    const unsigned long long key = getProgramKey(vertexSrc, fragmentSrc);
+
+    for(int i = 0; i < programCache.pending.size(); ++i)
+    {
+        if(programCache.pending[i].key == key)
+        {
+            const PendingProgram p = programCache.pending[i];
+            programCache.pending[i] = programCache.pending.back();
+            programCache.pending.popBack();
+            return finishProgram(p);
+        }
+    }
+
+    const GLuint cached = loadProgramBinary(key);
+
+    if(cached)
+        return cached;
+
+    return finishProgram(startProgram(vertexSrc, fragmentSrc, key));
+}
+
+void deleteUnusedPrograms()
+{
+    for(const PendingProgram& p: programCache.pending)
+    {
+        // the shaders are still attached, they go with the program
+        if(p.vertex)
+        {
+            glDeleteShader(p.vertex);
+            glDeleteShader(p.fragment);
+        }
+
+        glDeleteProgram(p.program);
+    }
+
+    programCache.pending.clear();
+}
+
 void deleteProgram(const GLuint program)
 {
+    forgetGLProgram(program);
     glDeleteProgram(program);
 }
 
@@ -426,11 +923,11 @@ vec2 getTextSize(const Text& text, const Font& font)
     float x = 0.f;
     const float lineSpace = font.lineSpace * text.scale;
     vec2 size = {0.f, lineSpace};
-    const int strLen = strlen(text.str);
+    const char* str = text.str;
 
-    for(int i = 0; i < strLen; ++i)
+    while(*str)
     {
-        const char c = text.str[i];
+        const int c = decodeUtf8(str);
 
         if(c == '\n')
         {
@@ -440,8 +937,7 @@ vec2 getTextSize(const Text& text, const Font& font)
             continue;
         }
 
-        //                               warning fix
-        const Glyph& glyph = font.glyphs[int(c)];
+        const Glyph& glyph = getGlyph(font, c);
         x += glyph.advance * text.scale;
     }
     
@@ -468,15 +964,15 @@ GLBuffers createGLBuffers()
     };
 
     // static buffer
-    glBindBuffer(GL_ARRAY_BUFFER, glBuffers.vbo);
+    bindBuffer(GL_ARRAY_BUFFER, glBuffers.vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices, GL_STATIC_DRAW);
 
-    glBindVertexArray(glBuffers.vao);
+    bindVertexArray(glBuffers.vao);
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, nullptr);
     glEnableVertexAttribArray(0);
 
     // dynamic instanced buffer
-    glBindBuffer(GL_ARRAY_BUFFER, glBuffers.rectBo);
+    bindBuffer(GL_ARRAY_BUFFER, glBuffers.rectBo);
 
     glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
@@ -504,56 +1000,66 @@ GLBuffers createGLBuffers()
 
 void updateGLBuffers(GLBuffers& glBuffers, const Rect* const rects, const int count)
 {
-    glBindBuffer(GL_ARRAY_BUFFER, glBuffers.rectBo);
+    PROFILE_SCOPE("updateGLBuffers");
+    bindBuffer(GL_ARRAY_BUFFER, glBuffers.rectBo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(Rect) * count, rects, GL_DYNAMIC_DRAW);
 }
 
-// @TODO(matiTechno): do we need these?
-void bindProgram(const GLuint program)
+void updateSubGLBuffers(GLBuffers& glBuffers, const Rect* const rects, const int first,
+                        const int count)
 {
-    glUseProgram(program);
+    bindBuffer(GL_ARRAY_BUFFER, glBuffers.rectBo);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(Rect) * first, sizeof(Rect) * count, rects);
 }
 
 // call bindProgram() first
-void renderGLBuffers(GLBuffers& glBuffers, const int numRects)
+void renderGLBuffers(const GLBuffers& glBuffers, const int numRects)
 {
-    glBindVertexArray(glBuffers.vao);
+    bindVertexArray(glBuffers.vao);
     glDrawArraysInstanced(GL_TRIANGLES, 0, 6, numRects);
 }
 
 void deleteGLBuffers(GLBuffers& glBuffers)
 {
-    glDeleteVertexArrays(1, &glBuffers.vao);
-    glDeleteBuffers(1, &glBuffers.vbo);
-    glDeleteBuffers(1, &glBuffers.rectBo);
+    deleteVertexArrays(1, &glBuffers.vao);
+    deleteBuffers(1, &glBuffers.vbo);
+    deleteBuffers(1, &glBuffers.rectBo);
 }
 
 // returns the number of rects written
 int writeTextToBuffer(const Text& text, const Font& font, Rect* const buffer,
                       const int maxSize)
 {
+    PROFILE_SCOPE("writeTextToBuffer");
+    return layoutText(text, font, buffer, maxSize).numRects;
+}
+
+TextLayout layoutText(const Text& text, const Font& font, Rect* const buffer,
+                      const int maxSize)
+{
+    (void)maxSize; // asserts only
     int count = 0;
     const char* str = text.str;
     vec2 penPos = text.pos;
+    const float lineSpace = font.lineSpace * text.scale;
+    vec2 size = {0.f, lineSpace};
 
-    while(true)
+    while(*str)
     {
-        const char c = *str;
-        
-        if(c == '\0')
-            break;
+        const int c = decodeUtf8(str);
 
         if(c == '\n')
         {
+            size.x = max(size.x, penPos.x - text.pos.x);
             penPos.x = text.pos.x;
-            penPos.y += font.lineSpace * text.scale;
-            ++str;
+            penPos.y += lineSpace;
+            size.y += lineSpace;
             continue;
         }
 
-        //                               warning fix
-        const Glyph& glyph = font.glyphs[int(c)];
+        const Glyph& glyph = getGlyph(font, c);
 
+        assert(count < maxSize);
         Rect& rect = buffer[count];
 
         rect.pos = penPos + glyph.offset * text.scale;
@@ -567,12 +1073,90 @@ int writeTextToBuffer(const Text& text, const Font& font, Rect* const buffer,
         rect.rotation = 0.f;
 
         ++count;
-        assert(count <= maxSize);
         penPos.x += glyph.advance * text.scale;
-        ++str;
     }
 
-    return count;
+    size.x = max(size.x, penPos.x - text.pos.x);
+    return {count, size};
+}
+
+const TextMesh& getTextMesh(TextCache& cache, const Text& text, const Font& font)
+{
+    PROFILE_SCOPE("getTextMesh");
+    const int strLen = strlen(text.str);
+    unsigned long long key = hashBytes(text.str, strLen);
+    key = hashBytes(&font.texture.id, sizeof(font.texture.id), key);
+    key = hashBytes(&text.scale, sizeof(text.scale), key);
+    key = hashBytes(&text.color, sizeof(text.color), key);
+    const int generation = getGlyphCacheGeneration(font);
+    key = hashBytes(&generation, sizeof(generation), key);
+    key += key == 0; // 0 marks a free entry
+
+    ++cache.useCounter;
+    TextCache::Entry* lru = &cache.entries[0];
+
+    for(TextCache::Entry& entry: cache.entries)
+    {
+        if(entry.key == key && entry.fontTexture == font.texture.id && entry.scale == text.scale &&
+           entry.color == text.color && entry.generation == generation &&
+           entry.str.size() == strLen + 1 && memcmp(entry.str.data(), text.str, strLen + 1) == 0)
+        {
+            entry.lastUse = cache.useCounter;
+            return entry.mesh;
+        }
+
+        if(lru->key && (!entry.key || entry.lastUse < lru->lastUse))
+            lru = &entry;
+    }
+
+    if(!lru->key)
+        lru->mesh.glBuffers = createGLBuffers();
+
+    lru->key = key;
+    lru->str.resize(strLen + 1);
+    memcpy(lru->str.data(), text.str, strLen + 1);
+    lru->fontTexture = font.texture.id;
+    lru->scale = text.scale;
+    lru->color = text.color;
+    lru->generation = generation;
+    lru->lastUse = cache.useCounter;
+
+    Text origin = text;
+    origin.pos = {0.f, 0.f};
+
+    Array<Rect> rects;
+    rects.resize(max(strLen, 1));
+    const TextLayout layout = layoutText(origin, font, rects.data(), rects.size());
+
+    lru->mesh.numRects = layout.numRects;
+    lru->mesh.size = layout.size;
+    updateGLBuffers(lru->mesh.glBuffers, rects.data(), layout.numRects);
+    return lru->mesh;
+}
+
+void deleteTextCache(TextCache& cache)
+{
+    for(TextCache::Entry& entry: cache.entries)
+    {
+        if(entry.key)
+            deleteGLBuffers(entry.mesh.glBuffers);
+
+        entry.key = 0;
+    }
+}
+
+void renderTextMesh(const GLuint program, const TextMesh& mesh, const vec2 pos,
+                    const Camera& camera)
+{
+    uniform2f(program, "cameraPos", camera.pos - pos);
+    renderGLBuffers(mesh.glBuffers, mesh.numRects);
+    uniform2f(program, "cameraPos", camera.pos);
+}
+
+long long getTimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 static Array<WinEvent>* eventsPtr;
@@ -582,6 +1166,7 @@ static void keyCallback(GLFWwindow* const window, const int key, const int scanc
 {
     WinEvent e;
     e.type = WinEvent::Key;
+    e.time = getTimeNs();
     e.key.key = key;
     e.key.action = action;
     e.key.mods = mods;
@@ -594,9 +1179,15 @@ static void cursorPosCallback(GLFWwindow*, const double xpos, const double ypos)
 {
     WinEvent e;
     e.type = WinEvent::Cursor;
+    e.time = getTimeNs();
     e.cursor.pos.x = xpos;
     e.cursor.pos.y = ypos;
-    eventsPtr->pushBack(e);
+
+    // a burst of moves (ImGui, mouse look) becomes the last position
+    if(eventsPtr->size() && eventsPtr->back().type == WinEvent::Cursor)
+        eventsPtr->back() = e;
+    else
+        eventsPtr->pushBack(e);
 }
 
 static void mouseButtonCallback(GLFWwindow* const window, const int button, const int action,
@@ -604,6 +1195,7 @@ static void mouseButtonCallback(GLFWwindow* const window, const int button, cons
 {
     WinEvent e;
     e.type = WinEvent::MouseButton;
+    e.time = getTimeNs();
     e.mouseButton.button = button;
     e.mouseButton.action = action;
     e.mouseButton.mods = mods;
@@ -617,6 +1209,7 @@ static void scrollCallback(GLFWwindow* const window, const double xoffset,
 {
     WinEvent e;
     e.type = WinEvent::Scroll;
+    e.time = getTimeNs();
     e.scroll.offset.x = xoffset;
     e.scroll.offset.y = yoffset;
     eventsPtr->pushBack(e);
@@ -634,35 +1227,25 @@ class LogoScene: public Scene
 public:
     LogoScene()
     {
-        FCHECK( FMOD_System_CreateSound(fmodSystem, "res/sfx_sound_vaporizing.wav",
-                                        FMOD_CREATESAMPLE, nullptr, &sound_) );
+        sound_ = acquireSound("res/sfx_sound_vaporizing.wav", FMOD_CREATESAMPLE);
         
         FMOD_CHANNEL* channel;
         FCHECK( FMOD_System_PlaySound(fmodSystem, sound_, nullptr, false, &channel) );
         FCHECK( FMOD_Channel_SetVolume(channel, 0.1f) );
 
         glBuffers_ = createGLBuffers();
-        texture_ = createTextureFromFile("res/github.png");
-        font_ = createFontFromFile("res/Exo2-Black.otf", 38, 512);
-
-        Text text;
-        text.scale = 0.9f;
-        text.str = "m2games";
-        text.color = {1.f, 1.f, 1.f, 0.7f};
-        text.pos = (vec2(100.f) - getTextSize(text, font_)) / 2.f;
-
-        name_.numRects = writeTextToBuffer(text, font_, name_.rects, getSize(name_.rects));
-
-        for(int i = 0; i < name_.numRects; ++i)
-            name_.rects[i].pos.y -= name_.offset;
+        texture_ = acquireTextureAsync("res/github.png");
+        // GameScene uses the same font, it is prefetched here
+        font_ = acquireFontAsync("res/Exo2-Black.otf", 38, 512, true, true);
     }
 
     ~LogoScene() override
     {
         deleteGLBuffers(glBuffers_);
-        deleteTexture(texture_);
-        deleteFont(font_);
-        FCHECK( FMOD_Sound_Release(sound_) );
+        deleteTextCache(textCache_);
+        releaseTexture(texture_);
+        releaseFont(font_);
+        releaseSound(sound_);
     }
     
     void processInput(const Array<WinEvent>& events) override
@@ -680,6 +1263,27 @@ public:
 
     void render(GLuint program) override
     {
+        // the animation starts when the resources are uploaded
+        if(!loaded_)
+        {
+            if(!isFontReady(font_) || !isTextureReady(texture_))
+                return;
+
+            loaded_ = true;
+
+            Text text;
+            text.scale = 0.9f;
+            text.str = "m2games";
+            text.color = {1.f, 1.f, 1.f, 0.7f};
+            text.pos = (vec2(100.f) - getTextSize(text, *font_)) / 2.f;
+
+            name_.numRects = writeTextToBuffer(text, *font_, name_.rects,
+                                               getSize(name_.rects));
+
+            for(int i = 0; i < name_.numRects; ++i)
+                name_.rects[i].pos.y -= name_.offset;
+        }
+
         time_ += frame_.time;
 
         if(time_ > name_.time + 1.f)
@@ -692,23 +1296,20 @@ public:
 
         // first render some text in the pixel / viewport coordinates
         {
-            Rect rects[50];
-
             Text text;
-            text.pos = {50.f, 50.f};
             text.color = {1.f, 0.5f, 1.f, 1.f};
             text.str = "press ENTER / ESC / SPACE to skip";
 
-            const int count = writeTextToBuffer(text, font_, rects, getSize(rects));
-            updateGLBuffers(glBuffers_, rects, count);
+            Camera camera;
+            camera.pos = {0.f, 0.f};
+            camera.size = frame_.fbSize;
+            uniform2f(program, "cameraPos", camera.pos);
+            uniform2f(program, "cameraSize", camera.size);
+            uniform1i(program, "mode", getFragmentMode(*font_));
 
-            uniform2f(program, "cameraPos", 0.f, 0.f);
-            uniform2f(program, "cameraSize", frame_.fbSize);
-            uniform1i(program, "mode", FragmentMode::Font);
+            bindTexture(font_->texture);
 
-            bindTexture(font_.texture);
-
-            renderGLBuffers(glBuffers_, count);
+            renderTextMesh(program, getTextMesh(textCache_, text, *font_), {50.f, 50.f}, camera);
         }
 
         // from here we will use the virtual world coordinates to render the scene
@@ -729,7 +1330,7 @@ public:
             
             updateGLBuffers(glBuffers_, &rect, 1);
             uniform1i(program, "mode", FragmentMode::Texture);
-            bindTexture(texture_);
+            bindTexture(*texture_);
             renderGLBuffers(glBuffers_, 1);
         }
 
@@ -757,17 +1358,19 @@ public:
             }
 
             updateGLBuffers(glBuffers_, name_.rects, name_.numRects);
-            uniform1i(program, "mode", FragmentMode::Font);
-            bindTexture(font_.texture);
+            uniform1i(program, "mode", getFragmentMode(*font_));
+            bindTexture(font_->texture);
             renderGLBuffers(glBuffers_, name_.numRects);
         }
     }
 
 private:
     float time_ = 0.f;
+    bool loaded_ = false;
     GLBuffers glBuffers_;
-    Texture texture_;
-    Font font_;
+    Texture* texture_;
+    Font* font_;
+    TextCache textCache_;
     FMOD_SOUND* sound_;
 
     struct
@@ -829,9 +1432,80 @@ int getRandomInt(const int min, const int max)
 }
 
 GLFWwindow* gGlfwWindow;
+bool gSimulationThread = true;
+
+// sleeps until deadline - spinMargin and spins for the rest (ns)
+// spinMargin follows the observed oversleep (scheduler granularity)
+static void sleepAndSpinUntil(const long long deadline, long long& spinMargin)
+{
+    const long long wakeTime = deadline - spinMargin;
+    const long long now = getTimeNs();
 
-int main()
+    if(now < wakeTime)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(wakeTime - now));
+        const long long oversleep = getTimeNs() - wakeTime;
+
+        // grows at once, shrinks slowly, 0.1 - 4 ms
+        spinMargin = max(spinMargin - spinMargin / 64, oversleep + oversleep / 4);
+        spinMargin = min(4000000ll, max(100000ll, spinMargin));
+    }
+
+    while(getTimeNs() < deadline)
+        ;
+}
+
+static void printUsage()
 {
+    printf("usage: tetris [--record <file>] [--replay <file>] [--capture <file.y4m>]\n"
+           "              [--capture-size <width>x<height>] [--capture-fps <fps>]\n"
+           "              [--trace <file.json>] [--trace-seconds <seconds>]\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* recordFilename = nullptr;
+    const char* replayFilename = nullptr;
+    const char* captureFilename = nullptr;
+    ivec2 captureSize = {1280, 720};
+    int captureFps = 60;
+    const char* traceFilename = nullptr;
+    float traceSeconds = 0.f;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        const char* const value = i + 1 < argc ? argv[i + 1] : "";
+        bool ok = i + 1 < argc;
+
+        if(strcmp(argv[i], "--record") == 0)
+            recordFilename = value;
+        else if(strcmp(argv[i], "--replay") == 0)
+            replayFilename = value;
+        else if(strcmp(argv[i], "--capture") == 0)
+            captureFilename = value;
+        else if(strcmp(argv[i], "--capture-size") == 0)
+            ok = sscanf(value, "%dx%d", &captureSize.x, &captureSize.y) == 2;
+        else if(strcmp(argv[i], "--capture-fps") == 0)
+            ok = sscanf(value, "%d", &captureFps) == 1 && captureFps > 0;
+        else if(strcmp(argv[i], "--trace") == 0)
+            traceFilename = value;
+        else if(strcmp(argv[i], "--trace-seconds") == 0)
+            ok = sscanf(value, "%f", &traceSeconds) == 1 && traceSeconds > 0.f;
+        else
+            ok = false;
+
+        if(!ok || (recordFilename && replayFilename))
+        {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+
+        ++i;
+    }
+
+    // replays are rendered without a visible window as fast as possible
+    const bool headless = replayFilename && captureFilename;
+
     glfwSetErrorCallback(errorCallback);
 
     if(!glfwInit())
@@ -843,6 +1517,13 @@ int main()
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     GLFWwindow* window;
+
+    if(headless)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(captureSize.x, captureSize.y, "tetris", nullptr, nullptr);
+    }
+    else
     {
         GLFWmonitor* const monitor = glfwGetPrimaryMonitor();
         const GLFWvidmode* mode = glfwGetVideoMode(monitor);
@@ -861,7 +1542,21 @@ int main()
 	gGlfwWindow = window;
 
     // @TODO(matiTechno): do a research on rngs, shuffle bag (rand() might not be good enough)
-    srand(time(nullptr));
+    unsigned seed = time(nullptr);
+
+    if(replayFilename && !startReplay(replayFilename, seed))
+    {
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+
+    if(recordFilename && !startRecording(recordFilename, seed))
+    {
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+
+    srand(seed);
 
     // @TODO(matiTechno): fmod error handling? (currently we only print them)
     FCHECK( FMOD_System_Create(&fmodSystem) );
@@ -869,7 +1564,11 @@ int main()
 
     glfwMakeContextCurrent(window);
     gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
-    glfwSwapInterval(1);
+    glfwSwapInterval(headless ? 0 : 1);
+    initProgramCache();
+    initGpuTimers();
+    // compiled by the driver while the logo is shown
+    GameScene::prefetchPrograms();
 
     glfwSetKeyCallback(window, keyCallback);
     glfwSetCursorPosCallback(window, cursorPosCallback);
@@ -883,7 +1582,7 @@ int main()
 
     GLuint program = createProgram(vertexSrc, fragmentSrc);
 
-    glEnable(GL_BLEND);
+    setEnabled(GL_BLEND, true);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     Array<WinEvent> events;
@@ -892,7 +1591,27 @@ int main()
 
     Scene* scenes[10];
     int numScenes = 1;
-    scenes[0] = new LogoScene;
+    FrameArena frameArena;
+    // loose files from the working directory if there is no pack
+    openAssetPack("res.pak");
+
+    // game logs start with the game, the logo loads asynchronously (not deterministic)
+    // and the simulation is ticked with the logged frame times
+    if(recordFilename || replayFilename)
+    {
+        gSimulationThread = false;
+        scenes[0] = new GameScene;
+    }
+    else
+        scenes[0] = new LogoScene;
+
+    if(captureFilename && !startCapture(captureFilename, captureSize, captureFps))
+        glfwSetWindowShouldClose(window, true);
+
+    Array<WinEvent> replayEvents;
+    // video frames are emitted at a fixed timestep of the simulation time
+    double captureTime = 0.0;
+    int numVideoFrames = 0;
 
     struct
     {
@@ -901,17 +1620,125 @@ int main()
         float frameTimes[180] = {}; // ms
     } plot;
 
+    // redraw only on events and scene timers (Scene::frame_.nextChange)
+    struct
+    {
+        bool enabled = true;
+        float timeout = 0.f; // of the top scene, from the last frame
+        int numSettleFrames = 0; // ImGui needs a few frames to react to input
+    } idle;
+
+    // frame rate cap without vsync, the wait is at the start of the frame so the input is polled
+    // right before the simulation and render (vsync waits after them, in the swap)
+    struct
+    {
+        bool enabled = false;
+        int fps = 144;
+        long long deadline = 0; // ns, start of the next frame, 0 - not paced
+        long long spinMargin = 1000000; // ns
+        int numMissed = 0;
+
+        // of the last second, ms
+        float jitterSum = 0.f;
+        float jitterMax = 0.f;
+        int numFrames = 0;
+        float windowTime = 0.f;
+        float avgJitter = 0.f;
+        float maxJitter = 0.f;
+    } limiter;
+
+    setThreadName("main");
+
+#ifdef PROFILER
+    bool showProfiler = false;
+#endif
+
+    if(traceFilename)
+        startTrace(traceFilename, traceSeconds);
+
     double time = glfwGetTime();
 
     // for now we will handle only the top scene
     while(!glfwWindowShouldClose(window) && numScenes)
     {
+#ifdef PROFILER
+        profileFrame();
+#endif
+        traceBeginFrame();
+        events.clear();
+
+        // replays and captures need every frame
+        if(idle.enabled && idle.timeout > 0.f && !idle.numSettleFrames && !replayFilename &&
+           !isCapturing())
+        {
+            PROFILE_SCOPE("idle wait");
+            glfwWaitEventsTimeout(idle.timeout);
+            limiter.deadline = 0;
+        }
+        else
+        {
+            if(limiter.enabled && !replayFilename)
+            {
+                PROFILE_SCOPE("frame limiter");
+                const long long now = getTimeNs();
+
+                // the last frame took longer than the cap, don't catch up
+                if(now > limiter.deadline)
+                {
+                    limiter.numMissed += limiter.deadline != 0;
+                    limiter.deadline = now;
+                }
+                else
+                    sleepAndSpinUntil(limiter.deadline, limiter.spinMargin);
+
+                const float jitter = (getTimeNs() - limiter.deadline) / 1000000.f;
+                limiter.jitterSum += jitter;
+                limiter.jitterMax = max(limiter.jitterMax, jitter);
+                ++limiter.numFrames;
+                limiter.deadline += 1000000000ll / limiter.fps;
+            }
+            else
+                limiter.deadline = 0;
+
+            PROFILE_SCOPE("glfwPollEvents");
+            glfwPollEvents();
+        }
+
+        idle.numSettleFrames = events.size() ? 2 : max(0, idle.numSettleFrames - 1);
+
+        // F9 - start / stop a trace, for the hitches that show up only after a while
+        for(WinEvent& e: events)
+        {
+            if(e.type == WinEvent::Key && e.key.key == GLFW_KEY_F9 &&
+               e.key.action == GLFW_PRESS)
+            {
+                if(isTracing())
+                    stopTrace();
+                else
+                    startTrace(traceFilename ? traceFilename : "trace.json", traceSeconds);
+
+                e.type = WinEvent::Nil;
+            }
+        }
+
         double newTime = glfwGetTime();
-        const float dt = newTime - time;
+        float dt = newTime - time;
         time = newTime;
+        long long timeNs = getTimeNs(); // events are older
 
         plot.accumulator += dt;
         ++plot.frameCount;
+        limiter.windowTime += dt;
+
+        if(limiter.windowTime >= 1.f)
+        {
+            limiter.avgJitter = limiter.numFrames ? limiter.jitterSum / limiter.numFrames : 0.f;
+            limiter.maxJitter = limiter.jitterMax;
+            limiter.jitterSum = 0.f;
+            limiter.jitterMax = 0.f;
+            limiter.numFrames = 0;
+            limiter.windowTime = 0.f;
+        }
 
         if(plot.accumulator >= 0.033f)
         {
@@ -924,10 +1751,13 @@ int main()
             plot.frameCount = 0;
         }
 
-        FCHECK( FMOD_System_Update(fmodSystem) );
+        {
+            PROFILE_SCOPE("FMOD_System_Update");
+            FCHECK( FMOD_System_Update(fmodSystem) );
+        }
+
+        processResourceUploads(2.f);
 
-        events.clear();
-        glfwPollEvents();
         ImGui_ImplGlfwGL3_NewFrame();
 
         const bool imguiWantMouse = ImGui::GetIO().WantCaptureMouse;
@@ -941,19 +1771,70 @@ int main()
                                      e.type == WinEvent::Scroll))
                 e.type = WinEvent::Nil;
 
-            if(imguiWantKeyboard && (e.type == WinEvent::Key))
+            // releases pass, a key held when ImGui took the keyboard would stick otherwise
+            if(imguiWantKeyboard && (e.type == WinEvent::Key && e.key.action != GLFW_RELEASE))
                 e.type = WinEvent::Nil;
         }
 
+        if(replayFilename)
+        {
+            if(!replayFrame(dt, timeNs, replayEvents))
+            {
+                ImGui::EndFrame();
+                break;
+            }
+
+            events.clear();
+
+            for(const WinEvent& e: replayEvents)
+                events.pushBack(e);
+        }
+        else
+            recordFrame(dt, timeNs, events);
+
+        // replayed events have the times of the recording session (another clock epoch)
+        if(isMeasuringLatency() && !replayFilename)
+        {
+            long long inputTime = timeNs;
+
+            for(const WinEvent& e: events)
+            {
+                if(e.type != WinEvent::Nil)
+                    inputTime = min(inputTime, e.time);
+            }
+
+            if(inputTime != timeNs)
+            {
+                beginLatencySample(inputTime);
+                markLatencyStage(LatencyStage::Poll);
+            }
+        }
+
         ivec2 fbSize;
         glfwGetFramebufferSize(window, &fbSize.x, &fbSize.y);
-        glViewport(0, 0, fbSize.x, fbSize.y);
-        glClear(GL_COLOR_BUFFER_BIT);
+        const ivec2 windowFbSize = fbSize;
+        int numCaptureCopies = 0;
+
+        if(isCapturing())
+        {
+            captureTime += dt;
+            numCaptureCopies = int(captureTime * captureFps) - numVideoFrames;
+            numVideoFrames += numCaptureCopies;
+            fbSize = getCaptureSize();
+            beginCaptureFrame();
+        }
+        else
+        {
+            glViewport(0, 0, fbSize.x, fbSize.y);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
 
         Scene& scene = *scenes[numScenes - 1];
         scene.frame_.time = dt;
+        scene.frame_.timeNs = timeNs;
         scene.frame_.fbSize.x = fbSize.x;
         scene.frame_.fbSize.y = fbSize.y;
+        scene.frame_.arena = &frameArena;
         
         ImGui::Begin("main");
         {
@@ -981,6 +1862,7 @@ int main()
             ImGui::PushStyleColor(ImGuiCol_Text, {0.9f, 0.f, 0.f, 1.f});
             ImGui::Text("max   %.3f", maxTime);
             ImGui::PopStyleColor(2);
+            gpuTimersImgui();
             ImGui::Spacing();
             ImGui::PlotLines("", plot.frameTimes, getSize(plot.frameTimes), 0, nullptr, 0.f,
                              20.f, {0, 60});
@@ -996,22 +1878,148 @@ int main()
             if(ImGui::Button("off"))
                 glfwSwapInterval(0);
 
+            if(ImGui::Checkbox("frame limiter (vsync off)", &limiter.enabled) && limiter.enabled)
+            {
+                glfwSwapInterval(0);
+                limiter.numMissed = 0;
+            }
+
+            ImGui::SliderInt("cap fps", &limiter.fps, 30, 500);
+
+            if(limiter.enabled)
+            {
+                ImGui::Text("jitter avg %.3f max %.3f", limiter.avgJitter, limiter.maxJitter);
+                ImGui::Text("missed    %d", limiter.numMissed);
+                ImGui::Text("spin      %.3f", limiter.spinMargin / 1000000.f);
+            }
+
+            ImGui::Checkbox("idle when nothing changes", &idle.enabled);
+
+            ImGui::Spacing();
+            glStateImgui();
+
+            ImGui::Spacing();
+            ImGui::Text("frame arena KB: %.1f last frame, %.1f high water, %.1f capacity",
+                        frameArena.lastUsed() / 1024.f, frameArena.highWater() / 1024.f,
+                        frameArena.capacity() / 1024.f);
+
+            ImGui::Spacing();
+            bool measureLatency = isMeasuringLatency();
+
+            // waits for the gpu in the frames of an open sample (from an input until it is
+            // rendered), not available in replays
+            if(!replayFilename &&
+               ImGui::Checkbox("measure input latency (latency.csv)", &measureLatency))
+            {
+                if(measureLatency)
+                    startLatencyMeasurement("latency.csv");
+                else
+                    stopLatencyMeasurement();
+            }
+
+            if(isMeasuringLatency())
+            {
+                latencyImgui();
+
+                if(ImGui::Button("reset"))
+                    resetLatencyHistograms();
+            }
+
+#ifdef PROFILER
+            ImGui::Spacing();
+            ImGui::Checkbox("profiler", &showProfiler);
+#endif
+
+            ImGui::Spacing();
+            bool tracing = isTracing();
+
+            if(ImGui::Checkbox("trace (F9)", &tracing))
+            {
+                if(tracing)
+                    startTrace(traceFilename ? traceFilename : "trace.json", traceSeconds);
+                else
+                    stopTrace();
+            }
+
         }
         ImGui::End();
 
-        scene.processInput(events);
-        scene.update();
-        scene.render(program);
+#ifdef PROFILER
+        if(showProfiler)
+            profilerImgui(&showProfiler);
+#endif
+
+        {
+            PROFILE_SCOPE("processInput");
+            scene.processInput(events);
+        }
+
+        setLatencyInputTarget(scene.frame_.numInputTaken);
+        markLatencyStage(LatencyStage::ProcessInput);
+
+        {
+            PROFILE_SCOPE("update");
+            scene.update();
+        }
+
+        markLatencyStage(LatencyStage::Update);
+
+        {
+            PROFILE_SCOPE("render");
+            scene.render(program);
+        }
+        idle.timeout = scene.frame_.nextChange;
+
+        if(isCapturing())
+            endCaptureFrame(numCaptureCopies, windowFbSize);
+
+        {
+            PROFILE_SCOPE("ImGui render");
+            ImGui::Render();
+            beginGpuPass(GpuPass::ImGui);
+            ImGui_ImplGlfwGL3_RenderDrawData(ImGui::GetDrawData());
+            endGpuPass();
+        }
+
+        markLatencyStage(LatencyStage::Render);
+
+        {
+            PROFILE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
 
-        ImGui::Render();
-        ImGui_ImplGlfwGL3_RenderDrawData(ImGui::GetDrawData());
+        markLatencyStage(LatencyStage::Swap);
+        frameArena.reset();
 
-        glfwSwapBuffers(window);
+        // idle frames are not serialized with the gpu, their frame times stay as they are
+        if(isInLatencySample())
+        {
+            // the frame is done on the gpu, glFinish() without draining unrelated work
+            const GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(-1));
+            glDeleteSync(fence);
+            markLatencyStage(LatencyStage::Gpu);
+            endLatencySample(scene.frame_.numInputRendered);
+        }
+
+        gpuTimersFrame();
+        glStateFrame();
+        glyphCacheFrame();
+        traceEndFrame();
 
         Scene* newScene = nullptr;
         newScene = scene.frame_.newScene;
         scene.frame_.newScene = nullptr;
 
+        if(scene.frame_.popMe || newScene)
+            idle.timeout = 0.f;
+
+        if(scene.frame_.popMe)
+            traceInstant("scene popped");
+
+        if(newScene)
+            traceInstant("scene pushed");
+
         if(scene.frame_.popMe)
         {
             delete &scene;
@@ -1031,7 +2039,17 @@ int main()
         delete scenes[i];
     }
 
+    stopTrace();
+    stopCapture();
+    stopLatencyMeasurement();
+    stopReplay();
+    stopRecording();
+    deleteUnusedResources();
+    deleteUnusedPrograms();
+    closeAssetPack();
+
     deleteProgram(program);
+    deleteGpuTimers();
     ImGui_ImplGlfwGL3_Shutdown();
     ImGui::DestroyContext();
 
@@ -0,0 +1,128 @@
+// asset pack writer, see AssetPack.hpp
+// usage: packer <output file> <files...>
+// files are stored under the names given on the command line (res/github.png)
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "Array.hpp"
+#include "AssetPack.hpp"
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        printf("usage: packer <output file> <files...>\n");
+        return EXIT_FAILURE;
+    }
+
+    const char* const packFilename = argv[1];
+    const int numFiles = argc - 2;
+
+    AssetPackHeader header;
+    memcpy(header.magic, "APAK", 4);
+    header.version = assetPackVersion;
+    header.numEntries = numFiles;
+    header.tableSize = 1;
+
+    // load factor <= 0.5
+    while(header.tableSize < numFiles * 2)
+        header.tableSize *= 2;
+
+    Array<AssetPackEntry> table;
+    table.resize(header.tableSize);
+    memset(table.data(), 0, sizeof(AssetPackEntry) * table.size());
+
+    Array<unsigned char> payloads;
+    long long offset = sizeof(AssetPackHeader) + sizeof(AssetPackEntry) * table.size();
+
+    for(int i = 0; i < numFiles; ++i)
+    {
+        const char* const name = argv[i + 2];
+
+        if(strlen(name) >= sizeof(AssetPackEntry::name))
+        {
+            printf("name too long: %s\n", name);
+            return EXIT_FAILURE;
+        }
+
+        FILE* const fp = fopen(name, "rb");
+
+        if(!fp)
+        {
+            printf("could not open file: %s\n", name);
+            return EXIT_FAILURE;
+        }
+
+        fseek(fp, 0, SEEK_END);
+        const int size = ftell(fp);
+        rewind(fp);
+
+        const int padding = (assetPackAlignment - offset % assetPackAlignment) %
+                            assetPackAlignment;
+
+        const int begin = payloads.size() + padding;
+        payloads.resize(begin + size);
+        memset(payloads.data() + begin - padding, 0, padding);
+        const bool ok = fread(payloads.data() + begin, 1, size, fp) == size_t(size);
+        fclose(fp);
+
+        if(!ok)
+        {
+            printf("could not read file: %s\n", name);
+            return EXIT_FAILURE;
+        }
+
+        offset += padding;
+
+        const unsigned long long hash = hashAssetName(name);
+        int idx = hash & (header.tableSize - 1);
+
+        while(table[idx].hash)
+        {
+            if(table[idx].hash == hash && strcmp(table[idx].name, name) == 0)
+            {
+                printf("duplicate file: %s\n", name);
+                return EXIT_FAILURE;
+            }
+
+            idx = (idx + 1) & (header.tableSize - 1);
+        }
+
+        AssetPackEntry& entry = table[idx];
+        entry.hash = hash;
+        entry.offset = offset;
+        entry.size = size;
+        strcpy(entry.name, name);
+
+        offset += size;
+        printf("%s: %d bytes\n", name, size);
+    }
+
+    FILE* const fp = fopen(packFilename, "wb");
+
+    if(!fp)
+    {
+        printf("could not open file: %s\n", packFilename);
+        return EXIT_FAILURE;
+    }
+
+    const bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                    fwrite(table.data(), sizeof(AssetPackEntry), table.size(), fp) ==
+                    size_t(table.size()) &&
+                    fwrite(payloads.data(), 1, payloads.size(), fp) == size_t(payloads.size());
+
+    fclose(fp);
+
+    if(!ok)
+    {
+        printf("could not write file: %s\n", packFilename);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %d files, %lld bytes\n", packFilename, numFiles, offset);
+    return EXIT_SUCCESS;
+}
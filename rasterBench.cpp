@@ -0,0 +1,126 @@
+// SoftRaster.hpp throughput
+// usage: rasterBench [output.tga]
+// renders batches of random rects into a 1920 x 1080 framebuffer and prints rects / s for
+// one thread and all hardware threads, the last frame is written to output.tga
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "SoftRaster.cpp"
+
+static float random(const float min, const float max)
+{
+    return min + (max - min) * (rand() / float(RAND_MAX));
+}
+
+struct Batch
+{
+    const char* name;
+    int mode;
+    bool rotated;
+};
+
+int main(int argc, char** argv)
+{
+    if(argc > 2)
+    {
+        printf("usage: rasterBench [output.tga]\n");
+        return EXIT_FAILURE;
+    }
+
+    const ivec2 fbSize = {1920, 1080};
+    const int numRects = 10000;
+    const int numFrames = 20;
+
+    // checkerboard and a radial distance field (a circle glyph)
+    const int texSize = 64;
+    static unsigned char rgba[texSize * texSize * 4];
+    static unsigned char sdf[texSize * texSize];
+
+    for(int y = 0; y < texSize; ++y)
+    {
+        for(int x = 0; x < texSize; ++x)
+        {
+            const bool white = ((x / 8) + (y / 8)) % 2;
+            unsigned char* const p = rgba + (y * texSize + x) * 4;
+            p[0] = white ? 255 : 40;
+            p[1] = white ? 255 : 120;
+            p[2] = white ? 255 : 200;
+            p[3] = 255;
+
+            const float dx = x + 0.5f - texSize / 2.f;
+            const float dy = y + 0.5f - texSize / 2.f;
+            const float dist = texSize / 3.f - sqrtf(dx * dx + dy * dy);
+            sdf[y * texSize + x] = toByte((sdfOnEdgeValue + dist * sdfPixelDistScale) / 255.f);
+        }
+    }
+
+    const SoftTexture textures[] =
+    {
+        {{texSize, texSize}, 4, rgba, false},
+        {{texSize, texSize}, 1, sdf, true}
+    };
+
+    const Batch batches[] =
+    {
+        {"color", FragmentMode::Color, false},
+        {"color rotated", FragmentMode::Color, true},
+        {"texture rotated", FragmentMode::Texture, true},
+        {"font sdf", FragmentMode::FontSdf, false}
+    };
+
+    Array<Rect> rects;
+    rects.resize(numRects);
+    SoftFramebuffer fb;
+    resizeSoftFramebuffer(fb, fbSize);
+
+    SoftRenderState state;
+    state.camera.pos = {0.f, 0.f};
+    state.camera.size = {float(fbSize.x), float(fbSize.y)};
+
+    const int threadCounts[] = {1, 0};
+
+    for(const Batch& batch: batches)
+    {
+        srand(0);
+
+        for(Rect& rect: rects)
+        {
+            rect.size = vec2(random(8.f, 64.f));
+            rect.pos = {random(-32.f, fbSize.x), random(-32.f, fbSize.y)};
+            rect.color = {random(0.f, 1.f), random(0.f, 1.f), random(0.f, 1.f),
+                          random(0.3f, 1.f)};
+            rect.texRect = {0.f, 0.f, 1.f, 1.f};
+            rect.rotation = batch.rotated ? random(0.f, 6.28f) : 0.f;
+        }
+
+        state.mode = batch.mode;
+        state.texture = batch.mode == FragmentMode::Texture ? &textures[0] :
+                        batch.mode == FragmentMode::FontSdf ? &textures[1] : nullptr;
+
+        for(const int numThreads: threadCounts)
+        {
+            const auto start = std::chrono::steady_clock::now();
+
+            for(int i = 0; i < numFrames; ++i)
+            {
+                clearSoftFramebuffer(fb, {0.f, 0.f, 0.f, 1.f});
+                softRenderRects(fb, state, rects.data(), rects.size(), numThreads);
+            }
+
+            const std::chrono::duration<double> time = std::chrono::steady_clock::now() -
+                                                       start;
+
+            printf("%-16s threads: %-3d %6.2f ms / frame %10.0f rects / s\n", batch.name,
+                   numThreads ? numThreads : int(std::thread::hardware_concurrency()),
+                   time.count() * 1000.0 / numFrames, numRects * numFrames / time.count());
+        }
+    }
+
+    if(argc == 2 && !writeSoftFramebuffer(argv[1], fb))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+// SoftRaster.hpp golden checksums
+// usage: rasterTest [output.tga]
+// renders a small scene per fragment mode and compares a checksum of the framebuffer with the
+// stored one, blendSpan() is checked against blendPixel() for every alpha
+// after an intended change of the output update the checksums with the printed values, the
+// scene of the last failed mode (or of the last mode) is written to output.tga
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "SoftRaster.cpp"
+
+struct TestScene
+{
+    const char* name;
+    int mode;
+    unsigned int checksum;
+};
+
+// FNV-1a
+static unsigned int checksumPixels(const SoftFramebuffer& fb)
+{
+    unsigned int hash = 2166136261u;
+
+    for(const unsigned int pixel: fb.pixels)
+    {
+        for(int shift = 0; shift < 32; shift += 8)
+        {
+            hash ^= (pixel >> shift) & 0xFF;
+            hash *= 16777619u;
+        }
+    }
+
+    return hash;
+}
+
+// the SSE2 path of blendSpan() has to match the scalar blendPixel()
+static bool testBlendSpan()
+{
+    const unsigned int dstColors[] = {0x00000000, 0xFFFFFFFF, 0x80402010, 0x01FE7FC0};
+    const unsigned int srcColors[] = {0x000000, 0xFFFFFF, 0x3377BB, 0xFF00FF};
+    const int spanSize = 11; // 2 SSE2 iterations and a scalar tail
+
+    for(unsigned int a = 0; a < 256; ++a)
+    {
+        for(const unsigned int srcColor: srcColors)
+        {
+            for(const unsigned int dstColor: dstColors)
+            {
+                const unsigned int src = srcColor | (a << 24);
+                unsigned int span[spanSize];
+                unsigned int expected = dstColor;
+                blendPixel(expected, src);
+
+                for(unsigned int& pixel: span)
+                    pixel = dstColor;
+
+                blendSpan(span, spanSize, src);
+
+                for(const unsigned int pixel: span)
+                {
+                    if(pixel != expected)
+                    {
+                        printf("blendSpan() src: %08X dst: %08X got: %08X expected: %08X\n", src,
+                               dstColor, pixel, expected);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 2)
+    {
+        printf("usage: rasterTest [output.tga]\n");
+        return EXIT_FAILURE;
+    }
+
+    bool ok = testBlendSpan();
+    printf("%-10s %s\n", "blendSpan", ok ? "ok" : "FAILED");
+
+    const ivec2 fbSize = {96, 64};
+
+    // checkerboard, a coverage and a distance field circle (a glyph)
+    const int texSize = 16;
+    static unsigned char rgba[texSize * texSize * 4];
+    static unsigned char coverage[texSize * texSize];
+    static unsigned char sdf[texSize * texSize];
+
+    for(int y = 0; y < texSize; ++y)
+    {
+        for(int x = 0; x < texSize; ++x)
+        {
+            const bool white = ((x / 4) + (y / 4)) % 2;
+            unsigned char* const p = rgba + (y * texSize + x) * 4;
+            p[0] = white ? 255 : 40;
+            p[1] = white ? 255 : 120;
+            p[2] = white ? 255 : 200;
+            p[3] = white ? 255 : 128;
+
+            const float dx = x + 0.5f - texSize / 2.f;
+            const float dy = y + 0.5f - texSize / 2.f;
+            const float dist = texSize / 3.f - sqrtf(dx * dx + dy * dy);
+            coverage[y * texSize + x] = toByte(dist + 0.5f);
+            sdf[y * texSize + x] = toByte((sdfOnEdgeValue + dist * sdfPixelDistScale) / 255.f);
+        }
+    }
+
+    const SoftTexture textures[] =
+    {
+        {{texSize, texSize}, 4, rgba, false},
+        {{texSize, texSize}, 1, coverage, true},
+        {{texSize, texSize}, 1, sdf, true}
+    };
+
+    const TestScene scenes[] =
+    {
+        {"color", FragmentMode::Color, 0x8B951BEEu},
+        {"texture", FragmentMode::Texture, 0x5675E774u},
+        {"font", FragmentMode::Font, 0x9572614Du},
+        {"font sdf", FragmentMode::FontSdf, 0xDD8C3804u}
+    };
+
+    // overlapping, rotated, partly outside of the framebuffer, the alphas cover both halves
+    // of the 16 bit range of blendSpan()
+    Rect rects[6];
+
+    for(int i = 0; i < 6; ++i)
+    {
+        Rect& rect = rects[i];
+        rect.pos = {-8.f + i * 17.f, -6.f + (i % 3) * 22.f};
+        rect.size = {28.f + i * 3.f, 24.f};
+        rect.color = {1.f - i * 0.15f, 0.2f + i * 0.1f, 0.5f, 0.25f + i * 0.15f};
+        rect.texRect = {0.f, 0.f, 1.f, 1.f};
+        rect.rotation = (i % 2) ? 0.4f * i : 0.f;
+    }
+
+    SoftFramebuffer fb;
+    resizeSoftFramebuffer(fb, fbSize);
+
+    SoftRenderState state;
+    state.camera.pos = {0.f, 0.f};
+    state.camera.size = {float(fbSize.x), float(fbSize.y)};
+
+    const SoftTexture* const sceneTextures[] = {nullptr, &textures[0], &textures[1],
+                                                &textures[2]};
+    int outputScene = 3;
+
+    for(int i = 0; i < 4; ++i)
+    {
+        const TestScene& scene = scenes[i];
+        state.mode = scene.mode;
+        state.texture = sceneTextures[i];
+
+        // the tiles don't depend on the number of threads
+        unsigned int checksums[2];
+        const int threadCounts[] = {1, 0};
+
+        for(int j = 0; j < 2; ++j)
+        {
+            clearSoftFramebuffer(fb, {0.1f, 0.2f, 0.3f, 1.f});
+            softRenderRects(fb, state, rects, 6, threadCounts[j]);
+            checksums[j] = checksumPixels(fb);
+        }
+
+        const bool sceneOk = checksums[0] == scene.checksum && checksums[1] == scene.checksum;
+        printf("%-10s %s checksum: 0x%08Xu (threads: 0x%08Xu)\n", scene.name,
+               sceneOk ? "ok" : "FAILED", checksums[0], checksums[1]);
+
+        if(!sceneOk)
+        {
+            outputScene = i;
+            ok = false;
+        }
+    }
+
+    if(argc == 2)
+    {
+        state.mode = scenes[outputScene].mode;
+        state.texture = sceneTextures[outputScene];
+        clearSoftFramebuffer(fb, {0.1f, 0.2f, 0.3f, 1.f});
+        softRenderRects(fb, state, rects, 6, 1);
+
+        if(!writeSoftFramebuffer(argv[1], fb))
+            return EXIT_FAILURE;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}